@@ -0,0 +1,99 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "allocLatency.h"
+
+/*
+  Latency histograms.
+
+  Averages hide the allocations that scan a long free table or map a
+  new chunk, so each instrumented path counts its latencies into
+  log2 buckets: bucket i holds latencies in [2^i, 2^(i+1)) ticks
+  (bucket 0 also holds 0).
+  Ticks are TSC cycles on x86 and nanoseconds elsewhere.  The paths
+  are:
+
+    fast hit      an arena allocation that used a free block whole
+    split         an arena allocation that split its free block
+    coalesce      merging a freed arena block with its neighbours
+    grow          adding a chunk to the arena (also counted in the
+                  fast hit or split that needed it)
+    realloc copy  a resize that allocated, copied and freed
+
+  Recording happens under the arena lock, so the counters are plain.
+*/
+
+#if defined(__x86_64__) || defined(__i386__)
+#define TICK_UNIT "cycles"
+#else
+#define TICK_UNIT "ns"
+#endif
+
+static unsigned long long counts[LATENCY_PATHS][LATENCY_BUCKETS];
+
+#ifdef ALLOC_LATENCY
+static const char *pathNames[LATENCY_PATHS] = {
+  "fast hit", "split", "coalesce", "grow", "realloc copy"
+};
+
+static uint64_t maxTicks[LATENCY_PATHS];
+
+uint64_t latencyNow() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+void latencyRecord(int path, uint64_t ticks) {
+  counts[path][ticks ? 63 - __builtin_clzll(ticks) : 0] += 1;
+  if (ticks > maxTicks[path])
+    maxTicks[path] = ticks;
+}
+
+/* upper bound of the bucket holding the q-quantile (0 < q < 1) */
+static uint64_t quantile(int path, unsigned long long total, double q) {
+  unsigned long long seen = 0;
+  int i;
+  for (i = 0; i < LATENCY_BUCKETS - 1; i++)
+    if ((seen += counts[path][i]) >= q * total)
+      return ((uint64_t) 2 << i) - 1;
+  return maxTicks[path];
+}
+#endif
+
+void latencyCopy(int path, unsigned long long out[LATENCY_BUCKETS]) {
+  memcpy(out, counts[path], sizeof counts[path]);
+}
+
+void latencyPrint() {
+#ifndef ALLOC_LATENCY
+  fprintf(stderr, " latency: not recorded (build with -DALLOC_LATENCY)\n");
+#else
+  int path, i;
+  fprintf(stderr, " latency: in %s\n", TICK_UNIT);
+  for (path = 0; path < LATENCY_PATHS; path++) {
+    unsigned long long total = 0;
+    for (i = 0; i < LATENCY_BUCKETS; i++)
+      total += counts[path][i];
+    if (total == 0)
+      continue;
+    fprintf(stderr, " latency: %-12s n=%llu p50<=%llu p99<=%llu p999<=%llu max=%llu\n",
+            pathNames[path], total,
+            (unsigned long long) quantile(path, total, 0.5),
+            (unsigned long long) quantile(path, total, 0.99),
+            (unsigned long long) quantile(path, total, 0.999),
+            (unsigned long long) maxTicks[path]);
+    for (i = 0; i < LATENCY_BUCKETS; i++)
+      if (counts[path][i])
+        fprintf(stderr, "   [%llu, %llu): %llu\n", i ? 1ULL << i : 0,
+                i < 63 ? 2ULL << i : ~0ULL, counts[path][i]);
+  }
+#endif
+}
@@ -0,0 +1,26 @@
+#ifndef allocLatency_H
+#define allocLatency_H
+
+#include <stdint.h>
+#include "myAllocator.h"
+
+/*
+  Per-path latency histograms (see allocLatency.c).  Built only with
+  -DALLOC_LATENCY; otherwise the macros below compile to nothing.
+  Callers hold the arena lock.
+*/
+
+#ifdef ALLOC_LATENCY
+uint64_t latencyNow(void);
+void latencyRecord(int path, uint64_t ticks);
+#define LATENCY_START(t) uint64_t t = latencyNow()
+#define LATENCY_RECORD(path, t) latencyRecord(path, latencyNow() - (t))
+#else
+#define LATENCY_START(t)
+#define LATENCY_RECORD(path, t)
+#endif
+
+void latencyCopy(int path, unsigned long long counts[LATENCY_BUCKETS]);
+void latencyPrint(void);
+
+#endif // allocLatency_H
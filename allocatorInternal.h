@@ -0,0 +1,39 @@
+#ifndef allocatorInternal_H
+#define allocatorInternal_H
+
+#include <stddef.h>
+#include "myAllocator.h"
+
+/*
+  Hooks shared by myAllocator.c and its backends (not part of the
+  public API).  Callers hold the arena lock.
+*/
+
+/* block layout (see myAllocator.c), also used by persistentHeap.c */
+#define align8(x) (((x)+7) & ~7)
+#define alignUp(x, a) (((x)+(a)-1) & ~((a)-1))
+#define prefixSize align8(sizeof(BlockPrefix_t))
+#define suffixSize align8(sizeof(BlockSuffix_t))
+
+/* values of BlockPrefix_t.allocated: 0 (free) or BLOCK_ALLOCATED plus flags */
+#define BLOCK_ALLOCATED 1
+#define BLOCK_MAPPED 2		/* has its own mapping, see mapLargeRegion() */
+#define BLOCK_SENTINEL 4	/* bounds a chunk, see newChunk() */
+#define BLOCK_GROWN 8		/* made by a moving realloc growth, see resizeRegion() */
+#define BLOCK_MOVABLE 16	/* reached through a handle, see compactArena() */
+
+BlockPrefix_t *makeFreeBlock(void *addr, size_t size);
+BlockPrefix_t *computeNextPrefixAddr(BlockPrefix_t *p);
+BlockSuffix_t *computePrevSuffixAddr(BlockPrefix_t *p);
+void *prefixToRegion(BlockPrefix_t *p);
+BlockPrefix_t *arenaAllocBlock(size_t s, size_t requested);
+int reserveRange(void *addr, size_t length, int flags); /* see allocatorReserve() */
+void arenaFreeBlock(BlockPrefix_t *p);
+
+/* accounting behind getAllocatorStats() */
+void noteHeapGrowth(size_t s);
+void noteHeapShrink(size_t s);
+void noteRegionAllocated(size_t requested, size_t usable, size_t metadata);
+void noteRegionFreed(size_t requested, size_t usable, size_t metadata);
+
+#endif // allocatorInternal_H
@@ -0,0 +1,266 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <assert.h>
+#include <sys/mman.h>
+#include "allocatorInternal.h"
+#include "pageMap.h"
+#include "buddyAlloc.h"
+
+/*
+  Buddy allocator for medium sizes.
+
+  Requests from BUDDY_MIN up to (but not including) the mmap threshold
+  get a block of 2^k pages (order k, 4K up to BUDDY_MAX) instead of a
+  block in the arena, where blocks of such different sizes fragment it
+  badly.  Blocks come from one reserved region, carved lazily into
+  BUDDY_MAX top blocks.  A block of order k starting at page i has its
+  buddy at page i ^ 2^k, so freeing finds the one neighbour it may
+  merge with by arithmetic, and merging up to BUDDY_MAX takes at most
+  BUDDY_ORDERS-1 steps: no boundary tags and no walk.
+
+  All metadata lives out of line in pages[], one entry per page of the
+  region, meaningful only for the first page of a block (a head); every
+  other entry is BUDDY_NONE.  Free heads are on a doubly-linked list
+  per order, linked by page index.  Allocation takes the smallest free
+  block of sufficient order and splits it, pushing the upper halves
+  back.  A top block that becomes entirely free again is returned to
+  the kernel (MADV_DONTNEED) but stays on its list, unless it is the
+  only free one, so a malloc/free pair of a large size doesn't fault
+  its pages in every time.
+*/
+
+#define BUDDY_PAGE 4096
+#define BUDDY_ORDERS 9		/* 4K .. BUDDY_MAX */
+#define BUDDY_REGION_SIZE (256 << 20) /* reserved address space */
+#define BUDDY_NPAGES (BUDDY_REGION_SIZE / BUDDY_PAGE)
+#define BUDDY_TOP_PAGES (BUDDY_MAX / BUDDY_PAGE)
+#define NIL UINT32_MAX
+
+enum { BUDDY_NONE, BUDDY_FREE, BUDDY_USED };
+
+typedef struct BuddyPage_s {
+  uint32_t prev, next;		/* free list of this order */
+  uint32_t requested;		/* used: bytes asked for */
+  unsigned char state, order;
+  unsigned char released;	/* free top block: pages given back */
+} BuddyPage_t;
+
+static char *regionBegin = 0;
+static Span_t regionSpan = { SPAN_BUDDY };
+static BuddyPage_t pages[BUDDY_NPAGES];
+static uint32_t freeLists[BUDDY_ORDERS];
+static uint32_t pagesCarved = 0; /* pages[0..pagesCarved) are in top blocks */
+static uint32_t topUsed[BUDDY_NPAGES / BUDDY_TOP_PAGES]; /* pages in use per top block */
+static uint32_t pagesUsed = 0;
+
+static char *pageAddr(uint32_t i) { return regionBegin + (size_t) i * BUDDY_PAGE; }
+
+static uint32_t pageIndex(void *r) { return ((char *) r - regionBegin) / BUDDY_PAGE; }
+
+static size_t orderSize(int order) { return (size_t) BUDDY_PAGE << order; }
+
+static int sizeOrder(size_t s) {
+  int order = 0;
+  while (orderSize(order) < s)
+    order++;
+  return order;
+}
+
+size_t buddyBlockSize(size_t s) { return orderSize(sizeOrder(s)); }
+
+static void pushFree(uint32_t i, int order) {
+  BuddyPage_t *p = &pages[i];
+  p->state = BUDDY_FREE;
+  p->order = order;
+  p->prev = NIL;
+  p->next = freeLists[order];
+  if (p->next != NIL)
+    pages[p->next].prev = i;
+  freeLists[order] = i;
+}
+
+static void unlinkFree(uint32_t i) {
+  BuddyPage_t *p = &pages[i];
+  if (p->prev != NIL)
+    pages[p->prev].next = p->next;
+  else
+    freeLists[p->order] = p->next;
+  if (p->next != NIL)
+    pages[p->next].prev = p->prev;
+}
+
+/* reserve the region on first use, 0 if we can't */
+static int reserveRegion() {
+  int order;
+  void *p = mmap(0, BUDDY_REGION_SIZE, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (p == MAP_FAILED)
+    return 0;
+  if (!pageMapSet(p, BUDDY_REGION_SIZE, &regionSpan)) {
+    munmap(p, BUDDY_REGION_SIZE);
+    return 0;
+  }
+  regionBegin = p;
+  regionSpan.begin = regionBegin;
+  regionSpan.length = BUDDY_REGION_SIZE;
+  for (order = 0; order < BUDDY_ORDERS; order++)
+    freeLists[order] = NIL;
+  return 1;
+}
+
+/* add a top block to the free list, 0 if the region is full */
+static int newTopBlock() {
+  if (pagesCarved == BUDDY_NPAGES)
+    return 0;			/* region full: caller falls back to the arena */
+  pushFree(pagesCarved, BUDDY_ORDERS - 1);
+  pages[pagesCarved].released = 0;
+  pagesCarved += BUDDY_TOP_PAGES;
+  noteHeapGrowth(BUDDY_MAX);
+  return 1;
+}
+
+void *buddyAlloc(size_t s) {
+  int order = sizeOrder(s), k;
+  uint32_t i;
+  if (regionBegin == 0 && !reserveRegion())
+    return 0;
+  for (k = order; k < BUDDY_ORDERS && freeLists[k] == NIL; k++)
+    ;
+  if (k == BUDDY_ORDERS) {
+    if (!newTopBlock())
+      return 0;
+    k = BUDDY_ORDERS - 1;
+  }
+  i = freeLists[k];
+  unlinkFree(i);
+  if (pages[i].released && k == BUDDY_ORDERS - 1) { /* its pages come back */
+    pages[i].released = 0;
+    noteHeapGrowth(BUDDY_MAX);
+  }
+  while (k > order) {		/* split, keeping the lower half */
+    k--;
+    pushFree(i + (1u << k), k);
+    pages[i + (1u << k)].released = 0;
+  }
+  pages[i].state = BUDDY_USED;
+  pages[i].order = order;
+  pages[i].requested = s;
+  topUsed[i / BUDDY_TOP_PAGES] += 1u << order;
+  pagesUsed += 1u << order;
+  noteRegionAllocated(s, orderSize(order), 0);
+  return pageAddr(i);
+}
+
+int buddyOwns(void *r) {
+  return regionBegin && (char *) r >= regionBegin && (char *) r < regionBegin + BUDDY_REGION_SIZE;
+}
+
+static BuddyPage_t *usedHead(void *r) {
+  BuddyPage_t *p = &pages[pageIndex(r)];
+  if (((char *) r - regionBegin) % BUDDY_PAGE != 0 || p->state != BUDDY_USED) {
+    fprintf(stderr, "buddyAlloc: double or invalid free of %p\n", r);
+    abort();
+  }
+  return p;
+}
+
+void buddyFree(void *r) {
+  BuddyPage_t *p = usedHead(r);
+  uint32_t i = pageIndex(r);
+  int order = p->order;
+  noteRegionFreed(p->requested, orderSize(order), 0);
+  topUsed[i / BUDDY_TOP_PAGES] -= 1u << order;
+  pagesUsed -= 1u << order;
+  p->state = BUDDY_NONE;
+  while (order < BUDDY_ORDERS - 1) {
+    uint32_t b = i ^ (1u << order);
+    if (pages[b].state != BUDDY_FREE || pages[b].order != order)
+      break;			/* buddy in use, or split */
+    unlinkFree(b);
+    pages[b].state = BUDDY_NONE;
+    i &= ~(1u << order);	/* the merged block starts at the lower one */
+    order++;
+  }
+  if (order == BUDDY_ORDERS - 1 && freeLists[order] != NIL
+      && madvise(pageAddr(i), BUDDY_MAX, MADV_DONTNEED) == 0) { /* (fails if mlock()ed) */
+    uint32_t first = freeLists[order]; /* a whole top block, not the only one: given back, */
+    pages[i].state = BUDDY_FREE;
+    pages[i].order = order;
+    pages[i].released = 1;
+    pages[i].prev = first;	/* and list it after first, which is used first */
+    pages[i].next = pages[first].next;
+    if (pages[i].next != NIL)
+      pages[pages[i].next].prev = i;
+    pages[first].next = i;
+    noteHeapShrink(BUDDY_MAX);
+  } else {
+    pushFree(i, order);
+  }
+}
+
+/* have a free top block ready, see allocatorReserve() */
+int buddyReserve(int flags) {
+  uint32_t i;
+  if (regionBegin == 0 && !reserveRegion())
+    return -1;
+  if (freeLists[BUDDY_ORDERS - 1] == NIL && !newTopBlock())
+    return -1;
+  i = freeLists[BUDDY_ORDERS - 1];
+  if (pages[i].released) {	/* its pages come back */
+    pages[i].released = 0;
+    noteHeapGrowth(BUDDY_MAX);
+  }
+  return reserveRange(pageAddr(i), BUDDY_MAX, flags);
+}
+
+/* r may keep its block for newSize unless that wastes three quarters */
+int buddyResize(void *r, size_t newSize) {
+  BuddyPage_t *p = usedHead(r);
+  size_t usable = orderSize(p->order);
+  if (newSize > usable || newSize <= usable / 4)
+    return 0;
+  noteRegionFreed(p->requested, usable, 0);
+  p->requested = newSize;
+  noteRegionAllocated(newSize, usable, 0);
+  return 1;
+}
+
+size_t buddyUsableSpace(void *r) { return orderSize(pages[pageIndex(r)].order); }
+
+/* r's top block is emptier than the average one: moving r helps it
+   empty and be given back */
+int buddyOccupancy(void *r, RegionOccupancy_t *occ) {
+  uint32_t used = topUsed[pageIndex(r) / BUDDY_TOP_PAGES];
+  occ->containerUsed = (size_t) used * BUDDY_PAGE;
+  occ->containerSize = BUDDY_MAX;
+  occ->kindUsed = (size_t) pagesUsed * BUDDY_PAGE;
+  occ->kindSize = (size_t) pagesCarved * BUDDY_PAGE;
+  return (uint64_t) used * pagesCarved < (uint64_t) pagesUsed * BUDDY_TOP_PAGES;
+}
+
+void buddyCheck() {		/* consistency check: heads tile the top blocks */
+  uint32_t i, n;
+  int order, nfree = 0, listed = 0;
+  size_t used = 0;
+  for (i = 0; i < pagesCarved; i += 1u << pages[i].order) {
+    assert(pages[i].state != BUDDY_NONE); /* every block has a head */
+    assert((i & ((1u << pages[i].order) - 1)) == 0); /* aligned to its size */
+    for (n = 1; n < (1u << pages[i].order); n++)
+      assert(pages[i + n].state == BUDDY_NONE);
+    if (pages[i].state == BUDDY_FREE)
+      nfree++;
+    else
+      used += orderSize(pages[i].order);
+  }
+  for (order = 0; order < BUDDY_ORDERS && regionBegin; order++)
+    for (i = freeLists[order]; i != NIL; i = pages[i].next) {
+      assert(pages[i].state == BUDDY_FREE && pages[i].order == order);
+      listed++;
+    }
+  assert(listed == nfree);
+  if (pagesCarved)
+    fprintf(stderr, " bcheck: free blocks=%d, amtAllocated=%zdk, topBlocks=%d\n",
+            nfree, used / 1024, (int) (pagesCarved / BUDDY_TOP_PAGES));
+}
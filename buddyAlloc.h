@@ -0,0 +1,26 @@
+#ifndef buddyAlloc_H
+#define buddyAlloc_H
+
+#include <stddef.h>
+#include "myAllocator.h"
+
+/*
+  Binary buddy allocator for page-granular medium sizes (see
+  buddyAlloc.c).  Callers hold the arena lock; the page map tells which
+  regions are buddy blocks.
+*/
+
+#define BUDDY_MIN 4096		/* smallest request served here: a page */
+#define BUDDY_MAX 0x100000	/* largest block: 1M */
+
+void *buddyAlloc(size_t s);
+size_t buddyBlockSize(size_t s);	/* usable space buddyAlloc(s) gives */
+int buddyOwns(void *r);		/* r is in the buddy region? */
+void buddyFree(void *r);
+int buddyResize(void *r, size_t newSize); /* true if r can stay */
+size_t buddyUsableSpace(void *r);
+int buddyOccupancy(void *r, RegionOccupancy_t *occ);
+int buddyReserve(int flags);
+void buddyCheck(void);
+
+#endif // buddyAlloc_H
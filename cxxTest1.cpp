@@ -0,0 +1,71 @@
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <memory_resource>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#define MYALLOCATOR_REPLACE_NEW
+#include "myAllocator.hpp"
+#include "objectPool.hpp"
+
+struct alignas(64) CacheLine {
+  char bytes[64];
+};
+
+struct TreeNode {
+  TreeNode *left, *right;
+  int key;
+  TreeNode(int k) : left(nullptr), right(nullptr), key(k) {}
+};
+
+int main()
+{
+  arenaCheck();
+  {				/* STL containers with myAllocator::Allocator */
+    std::vector<int, myAllocator::Allocator<int>> v;
+    for (int i = 0; i < 1000; i++)
+      v.push_back(i);
+    std::unordered_map<int, int, std::hash<int>, std::equal_to<int>,
+                       myAllocator::Allocator<std::pair<const int, int>>> m;
+    for (int i = 0; i < 100; i++)
+      m[i] = i * i;
+    std::vector<long, myAllocator::Allocator<long, myAllocator::BestFit>> b(v.begin(), v.end());
+    assert(v[999] == 999 && m[9] == 81 && b[999] == 999);
+    arenaCheck();
+  }
+  {				/* pmr containers on the arena resource */
+    std::pmr::vector<std::pmr::string> names(myAllocator::arenaResource());
+    names.emplace_back("a string long enough to defeat the small string optimization");
+    std::pmr::map<int, int> sq(myAllocator::arenaResource());
+    sq[3] = 9;
+    assert(names.size() == 1 && sq[3] == 9);
+  }
+  {				/* replacement new/delete, incl. over-aligned */
+    int *ip = new int(4);
+    CacheLine *cl = new CacheLine[3];
+    assert(((std::uintptr_t)cl & 63) == 0);
+    printf("%p %p\n", (void *)ip, (void *)cl);
+    delete ip;
+    delete[] cl;
+  }
+  {				/* object pools, shared and per-thread */
+    myAllocator::ObjectPool<TreeNode> pool;
+    TreeNode *root = pool.construct(1);
+    root->left = pool.construct(0);
+    pool.destroy(root->left);
+    assert(pool.construct(2) == root->left); /* freed slot is reused first */
+    std::thread t([] {
+      auto &local = myAllocator::ObjectPool<CacheLine>::local();
+      CacheLine *c = local.construct();
+      assert(((std::uintptr_t)c & 63) == 0);
+      local.destroy(c);
+    });
+    t.join();
+  }
+  arenaCheck();
+  return 0;
+}
@@ -0,0 +1,127 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <limits.h>
+#include <sys/mman.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#include "freeTable.h"
+
+/*
+  Free-block summary table.
+
+  Searching the arena block by block chases a pointer into every block
+  and reads its prefix, which is usually a cache miss.  Instead, every
+  free block has an entry in two parallel, densely packed arrays: its
+  usable size (sizes[], 32 bits, saturated) and its prefix (blocks[]).
+  A free block's prefix remembers its entry (freeIndex), so inserting,
+  removing and resizing are O(1); removal moves the last entry into
+  the hole.
+
+  Fit searches only touch sizes[], comparing 8 sizes per instruction
+  with AVX2 or 4 with SSE2 (plain C elsewhere), and read a block's
+  prefix only once it has been chosen, or when its size is saturated
+  and only the prefix knows whether it is big enough.  Because of the swap-on-remove,
+  "first fit" means first in table order, not lowest address.
+
+  The arrays live in their own mapping (we can't call malloc) and
+  double with mremap() when full.
+*/
+
+#define INITIAL_CAPACITY 4096
+
+static int32_t *sizes = 0;
+static BlockPrefix_t **blocks = 0;
+static size_t count = 0, capacity = 0;
+
+static int32_t tableSize(BlockPrefix_t *p) {
+  size_t s = computeUsableSpace(p);
+  return s < INT32_MAX ? (int32_t) s : INT32_MAX;
+}
+
+static void *growArray(void *a, size_t oldBytes, size_t newBytes) {
+  void *n = a ? mremap(a, oldBytes, newBytes, MREMAP_MAYMOVE)
+              : mmap(0, newBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (n == MAP_FAILED) {
+    fprintf(stderr, "freeTable: can't grow to %zd bytes\n", newBytes);
+    abort();
+  }
+  return n;
+}
+
+void freeTableInsert(BlockPrefix_t *p) {
+  if (count == capacity) {
+    size_t n = capacity ? 2 * capacity : INITIAL_CAPACITY;
+    sizes = growArray(sizes, capacity * sizeof(*sizes), n * sizeof(*sizes));
+    blocks = growArray(blocks, capacity * sizeof(*blocks), n * sizeof(*blocks));
+    capacity = n;
+  }
+  sizes[count] = tableSize(p);
+  blocks[count] = p;
+  p->freeIndex = count++;
+}
+
+void freeTableRemove(BlockPrefix_t *p) {
+  unsigned i = p->freeIndex;
+  if (i != --count) {		/* move the last entry into the hole */
+    sizes[i] = sizes[count];
+    blocks[i] = blocks[count];
+    blocks[i]->freeIndex = i;
+  }
+}
+
+void freeTableUpdate(BlockPrefix_t *p) { sizes[p->freeIndex] = tableSize(p); }
+
+/* entry i's real size, from the prefix if the table's is saturated */
+static size_t entrySize(size_t i) { return sizes[i] < INT32_MAX ? (size_t) sizes[i] : computeUsableSpace(blocks[i]); }
+
+BlockPrefix_t *freeTableFirstFit(size_t s) {
+  int32_t key = s < INT32_MAX ? (int32_t) s - 1 : INT32_MAX - 1; /* want sizes[i] > key */
+  size_t i = 0;
+#if defined(__AVX2__)
+  __m256i k = _mm256_set1_epi32(key);
+  for (; i + 8 <= count; i += 8) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) (sizes + i));
+    int m = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(v, k)));
+    for (; m; m &= m - 1)	/* a saturated size may still be too small */
+      if (entrySize(i + __builtin_ctz(m)) >= s)
+        return blocks[i + __builtin_ctz(m)];
+  }
+#elif defined(__SSE2__)
+  __m128i k = _mm_set1_epi32(key);
+  for (; i + 4 <= count; i += 4) {
+    __m128i v = _mm_loadu_si128((const __m128i *) (sizes + i));
+    int m = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(v, k)));
+    for (; m; m &= m - 1)
+      if (entrySize(i + __builtin_ctz(m)) >= s)
+        return blocks[i + __builtin_ctz(m)];
+  }
+#endif
+  for (; i < count; i++)
+    if (sizes[i] > key && entrySize(i) >= s)
+      return blocks[i];
+  return 0;
+}
+
+BlockPrefix_t *freeTableBestFit(size_t s) {
+  size_t best = SIZE_MAX, i;
+  BlockPrefix_t *bestFit = 0;
+  for (i = 0; i < count; i++) {
+    size_t size = entrySize(i);
+    if (size == s)
+      return blocks[i];
+    if (size > s && size < best) {
+      best = size;
+      bestFit = blocks[i];
+    }
+  }
+  return bestFit;
+}
+
+size_t freeTableCount() { return count; }
+
+int freeTableHolds(BlockPrefix_t *p) {
+  return p->freeIndex < count && blocks[p->freeIndex] == p && sizes[p->freeIndex] == tableSize(p);
+}
@@ -0,0 +1,19 @@
+#ifndef freeTable_H
+#define freeTable_H
+
+#include "myAllocator.h"
+
+/*
+  Dense table of the arena's free blocks (see freeTable.c).  Callers
+  hold the arena lock.
+*/
+
+void freeTableInsert(BlockPrefix_t *p);
+void freeTableRemove(BlockPrefix_t *p);
+void freeTableUpdate(BlockPrefix_t *p);	/* p's size changed */
+BlockPrefix_t *freeTableFirstFit(size_t s);
+BlockPrefix_t *freeTableBestFit(size_t s);
+size_t freeTableCount(void);
+int freeTableHolds(BlockPrefix_t *p);
+
+#endif // freeTable_H
@@ -0,0 +1,155 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "allocatorInternal.h"
+#include "pageMap.h"
+#include "guardedAlloc.h"
+
+/*
+  Sampled guard-page allocations, for catching heap corruption in
+  production without running a full ASan build.
+
+  Roughly one in guardedSampleRate allocations (only those that fit in a
+  page) is served from a separate pool instead of the arena.  The pool
+  is one mapping of GUARDED_SLOTS single-page slots, each surrounded by
+  PROT_NONE guard pages:
+
+      guard | slot 0 | guard | slot 1 | guard | ... | guard
+
+  A sampled region is placed at the end of its slot (rounded down to 8
+  bytes), so running off its end touches the next guard page at once.
+  Freeing a region makes its slot PROT_NONE, so any later use faults;
+  slots are recycled round-robin, so a freed slot stays poisoned as long
+  as possible.  A SIGSEGV handler explains faults inside the pool before
+  letting the default action kill the process; double and invalid frees
+  of sampled regions are reported and abort().
+
+  Set MYALLOCATOR_GUARD_RATE=N in the environment (or guardedSampleRate)
+  to enable sampling.
+*/
+
+#define GUARDED_SLOTS 64
+
+enum { SLOT_UNUSED, SLOT_ALLOCATED, SLOT_FREED };
+
+typedef struct GuardedSlot_s {
+  size_t requested;		/* bytes asked for; region ends at the guard */
+  int state;
+} GuardedSlot_t;
+
+int guardedSampleRate = 0;
+
+static char *poolBegin = 0, *poolEnd = 0;
+static Span_t poolSpan = { SPAN_GUARDED };
+static size_t pageSize;
+static GuardedSlot_t slots[GUARDED_SLOTS];
+static int nextSlot = 0;	/* round-robin reuse */
+static long untilSample = 0;	/* allocations left before the next sample */
+static unsigned long long rng = 0x2545f4914f6cdd1dULL;
+static struct sigaction previousSegv;
+
+static char *slotAddr(int i) { return poolBegin + (2 * i + 1) * pageSize; }
+
+static int slotIndex(void *r) { return ((char *) r - poolBegin) / pageSize / 2; }
+
+static void *slotRegion(int i) {
+  return (void *) ((size_t) (slotAddr(i) + pageSize - slots[i].requested) & ~(size_t) 7);
+}
+
+/* explain faults in the pool, then let the previous handler or the default action run */
+static void guardedSegv(int sig, siginfo_t *info, void *ctx) {
+  char *a = info->si_addr;
+  if (a >= poolBegin && a < poolEnd) {
+    char msg[160];
+    int i = slotIndex(a), n;
+    if (((a - poolBegin) / pageSize) % 2 == 0) /* a guard page */
+      n = snprintf(msg, sizeof msg, "guardedAlloc: %p: buffer overflow/underflow next to a guarded region\n", a);
+    else if (slots[i].state == SLOT_FREED)
+      n = snprintf(msg, sizeof msg, "guardedAlloc: %p: use after free of guarded region %p (%zd bytes)\n",
+                   a, slotRegion(i), slots[i].requested);
+    else
+      n = snprintf(msg, sizeof msg, "guardedAlloc: %p: invalid access in guarded pool\n", a);
+    write(2, msg, n);
+  }
+  sigaction(SIGSEGV, &previousSegv, 0); /* returning re-executes the access */
+}
+
+void guardedInit() {
+  char *rate = getenv("MYALLOCATOR_GUARD_RATE");
+  if (rate) {
+    guardedSampleRate = atoi(rate);
+    untilSample = guardedSampleRate;
+  }
+}
+
+static int reservePool() {
+  struct sigaction sa;
+  void *p;
+  pageSize = sysconf(_SC_PAGESIZE);
+  p = mmap(0, (2 * GUARDED_SLOTS + 1) * pageSize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED || !pageMapSet(p, (2 * GUARDED_SLOTS + 1) * pageSize, &poolSpan)) {
+    if (p != MAP_FAILED)
+      munmap(p, (2 * GUARDED_SLOTS + 1) * pageSize);
+    guardedSampleRate = 0;	/* give up on sampling */
+    return 0;
+  }
+  poolBegin = p;
+  poolEnd = poolBegin + (2 * GUARDED_SLOTS + 1) * pageSize;
+  poolSpan.begin = poolBegin;
+  poolSpan.length = poolEnd - poolBegin;
+  memset(&sa, 0, sizeof sa);
+  sa.sa_sigaction = guardedSegv;
+  sa.sa_flags = SA_SIGINFO;
+  sigaction(SIGSEGV, &sa, &previousSegv);
+  noteHeapGrowth(GUARDED_SLOTS * pageSize); /* the slots; guard pages have no memory */
+  return 1;
+}
+
+int guardedShouldSample(size_t s) {
+  if (--untilSample > 0)
+    return 0;
+  rng ^= rng << 13;		/* next gap is uniform in [1, 2N] */
+  rng ^= rng >> 7;
+  rng ^= rng << 17;
+  untilSample = 1 + rng % (2 * (unsigned long long) guardedSampleRate);
+  return (poolBegin || reservePool()) && s > 0 && s <= pageSize;
+}
+
+void *guardedAlloc(size_t s) {
+  int n, i;
+  for (n = 0; n < GUARDED_SLOTS; n++) { /* oldest slot that isn't in use */
+    i = (nextSlot + n) % GUARDED_SLOTS;
+    if (slots[i].state != SLOT_ALLOCATED)
+      break;
+  }
+  if (n == GUARDED_SLOTS)	/* pool exhausted: serve from the arena */
+    return 0;
+  nextSlot = (i + 1) % GUARDED_SLOTS;
+  if (mprotect(slotAddr(i), pageSize, PROT_READ | PROT_WRITE) != 0)
+    return 0;
+  slots[i].requested = s;
+  slots[i].state = SLOT_ALLOCATED;
+  noteRegionAllocated(s, guardedUsableSpace(slotRegion(i)), 0);
+  return slotRegion(i);
+}
+
+void guardedFree(void *r) {
+  int i = slotIndex(r);
+  if (slots[i].state != SLOT_ALLOCATED || r != slotRegion(i)) {
+    fprintf(stderr, "guardedAlloc: %s of guarded region %p\n",
+            slots[i].state == SLOT_FREED ? "double free" : "invalid free", r);
+    abort();
+  }
+  noteRegionFreed(slots[i].requested, guardedUsableSpace(r), 0);
+  slots[i].state = SLOT_FREED;
+  mprotect(slotAddr(i), pageSize, PROT_NONE);
+}
+
+size_t guardedUsableSpace(void *r) {
+  char *end = slotAddr(slotIndex(r)) + pageSize;
+  return end - (char *) r;
+}
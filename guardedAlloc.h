@@ -0,0 +1,19 @@
+#ifndef guardedAlloc_H
+#define guardedAlloc_H
+
+#include <stddef.h>
+
+/*
+  Sampled guard-page allocations (see guardedAlloc.c).  Callers hold
+  the arena lock; the page map tells which regions are guarded.
+*/
+
+extern int guardedSampleRate;	/* guard ~1 in N allocations, 0: off */
+
+void guardedInit(void);
+int guardedShouldSample(size_t s);
+void *guardedAlloc(size_t s);
+void guardedFree(void *r);
+size_t guardedUsableSpace(void *r);
+
+#endif // guardedAlloc_H
@@ -0,0 +1,107 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include "allocatorInternal.h"
+#include "handleAlloc.h"
+
+/*
+  Handles.
+
+  A region from hAlloc() may be moved by compactArena(), so its owner
+  keeps a handle instead: the address of an entry whose first field is
+  the region's current address (*h).  While hLock() has pinned it, a
+  region stays where it is.
+
+  A movable region is always an arena block marked BLOCK_MOVABLE, and
+  the block's payload starts with the address of its entry, so
+  compaction can find the entry of a block it slides and update it;
+  the caller's region follows that back pointer.  Entries never move:
+  they come from their own mapped blocks of ENTRY_BLOCK bytes and are
+  recycled through a free list.
+*/
+
+#define ENTRY_BLOCK 0x10000
+#define HANDLE_HEADER align8(sizeof(HandleEntry_t *))
+
+typedef struct HandleEntry_s {
+  void *region;			/* first: a Handle_t points here */
+  unsigned pins;		/* hLock()s not yet undone */
+  struct HandleEntry_s *next;	/* free list */
+} HandleEntry_t;
+
+static HandleEntry_t *freeEntries = 0;
+static HandleEntry_t *entryBump = 0, *entryEnd = 0;
+
+static HandleEntry_t *entryOf(BlockPrefix_t *p) { return *(HandleEntry_t **) prefixToRegion(p); }
+
+static BlockPrefix_t *blockOf(HandleEntry_t *e) { return regionToPrefix(e->region - HANDLE_HEADER); }
+
+static HandleEntry_t *entryNew() {
+  HandleEntry_t *e;
+  if (freeEntries) {
+    e = freeEntries;
+    freeEntries = e->next;
+  } else {
+    if (entryBump == entryEnd) {
+      void *m = mmap(0, ENTRY_BLOCK, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (m == MAP_FAILED)
+        return 0;
+      entryBump = m;
+      entryEnd = entryBump + ENTRY_BLOCK / sizeof(HandleEntry_t);
+    }
+    e = entryBump++;
+  }
+  e->pins = 0;
+  e->next = 0;
+  return e;
+}
+
+Handle_t hAllocLocked(size_t s) {
+  HandleEntry_t *e = entryNew();
+  BlockPrefix_t *p;
+  if (e == 0)
+    return 0;
+  if ((p = arenaAllocBlock(HANDLE_HEADER + s, s)) == 0) {
+    e->next = freeEntries;
+    freeEntries = e;
+    return 0;
+  }
+  p->allocated |= BLOCK_MOVABLE;
+  *(HandleEntry_t **) prefixToRegion(p) = e;
+  e->region = prefixToRegion(p) + HANDLE_HEADER;
+  return &e->region;
+}
+
+void *hLockLocked(Handle_t h) {
+  HandleEntry_t *e = (HandleEntry_t *) h;
+  e->pins += 1;
+  return e->region;
+}
+
+void hUnlockLocked(Handle_t h) {
+  HandleEntry_t *e = (HandleEntry_t *) h;
+  if (e->pins == 0) {
+    fprintf(stderr, "handleAlloc: unlock of %p, which isn't locked\n", (void *) h);
+    abort();
+  }
+  e->pins -= 1;
+}
+
+void hFreeLocked(Handle_t h) {
+  HandleEntry_t *e = (HandleEntry_t *) h;
+  if (h == 0)
+    return;
+  arenaFreeBlock(blockOf(e));
+  e->region = 0;
+  e->next = freeEntries;
+  freeEntries = e;
+}
+
+int handlePinned(BlockPrefix_t *p) { return entryOf(p)->pins != 0; }
+
+void handleMoved(BlockPrefix_t *p) { entryOf(p)->region = prefixToRegion(p) + HANDLE_HEADER; }
+
+int handleHolds(BlockPrefix_t *p) {
+  HandleEntry_t *e = entryOf(p);
+  return e && e->region && blockOf(e) == p;
+}
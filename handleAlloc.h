@@ -0,0 +1,21 @@
+#ifndef handleAlloc_H
+#define handleAlloc_H
+
+#include <stddef.h>
+#include "myAllocator.h"
+
+/*
+  Movable regions reached through handles (see handleAlloc.c).  Callers
+  hold the arena lock; compactArena() calls handlePinned() and
+  handleMoved() for each BLOCK_MOVABLE block.
+*/
+
+Handle_t hAllocLocked(size_t s);
+void *hLockLocked(Handle_t h);
+void hUnlockLocked(Handle_t h);
+void hFreeLocked(Handle_t h);
+int handlePinned(BlockPrefix_t *p);
+void handleMoved(BlockPrefix_t *p);	/* p is the block's new prefix */
+int handleHolds(BlockPrefix_t *p);
+
+#endif // handleAlloc_H
@@ -1,6 +1,9 @@
 #include <stdlib.h>
+#include <errno.h>
 
 #include "myAllocator.h"
+#include "mallocTrace.h"
+#include "mallocx.h"
 #include "string.h"
 
 #define align4(x) ((x+3) & ~3)
@@ -8,24 +11,94 @@
 
 /* first, the standard malloc functions */
 
+/* each call is recorded if MYALLOCATOR_TRACE is set, see mallocTrace.c */
+
 void *malloc(size_t NBYTES) {
-  return firstFitAllocRegion(NBYTES);
+  void *p = firstFitAllocRegion(NBYTES);
+  TRACE(TRACE_MALLOC, p, 0, NBYTES);
+  return p;
 }
 
 
 
+/* a realloc that moves frees APTR, so it is recorded before another
+   thread can get APTR back: with the arena still locked */
 void *realloc(void *APTR, size_t NBYTES) {
-  return resizeRegion(APTR, NBYTES);
+  void *p;
+  if (__atomic_load_n(&traceState, __ATOMIC_ACQUIRE) == TRACE_UNKNOWN)
+    traceStart();		/* decide now, not with the lock held */
+  if (__atomic_load_n(&traceState, __ATOMIC_ACQUIRE) != TRACE_ON)
+    return resizeRegion(APTR, NBYTES);
+  allocatorLock();
+  p = resizeRegion(APTR, NBYTES);
+  traceRecord(TRACE_REALLOC, p, APTR, NBYTES);
+  allocatorUnlock();
+  return p;
 }
 
-void free(void *APTR) { freeRegion(APTR); }
+void free(void *APTR) {
+  if (APTR)
+    TRACE(TRACE_FREE, APTR, 0, 0);
+  freeRegion(APTR);
+}
 
-void *memalign(size_t ALIGN, size_t NBYTES) { /* ignore ALIGN -- hack -- */
-  void *p = malloc(NBYTES+ALIGN); 
+/* C23 sized free: NBYTES must be the size passed to malloc/calloc/realloc */
+void free_sized(void *APTR, size_t NBYTES) {
+  if (APTR)
+    TRACE(TRACE_FREE, APTR, 0, NBYTES);
+  freeSizedRegion(APTR, NBYTES);
+}
+
+/* ...and its aligned_alloc/memalign counterpart */
+void free_aligned_sized(void *APTR, size_t ALIGN, size_t NBYTES) {
+  (void) ALIGN;			/* the region's own header says how it was aligned */
+  free_sized(APTR, NBYTES);
+}
+
+void *memalign(size_t ALIGN, size_t NBYTES) {
+  void *p;
+  if (ALIGN == 0 || (ALIGN & (ALIGN - 1))) { /* not a power of 2 */
+    errno = EINVAL;
+    return 0;
+  }
+  p = alignedAllocRegion(ALIGN, NBYTES);
+  TRACE(TRACE_MEMALIGN, p, (void *) ALIGN, NBYTES);
   return p;
 }
 
-size_t malloc_usable_size(void *APTR) { return computeUsableSpace(regionToPrefix(APTR)); }
+void *aligned_alloc(size_t ALIGN, size_t NBYTES) { return memalign(ALIGN, NBYTES); }
+
+int posix_memalign(void **MEMPTR, size_t ALIGN, size_t NBYTES) {
+  void *p;
+  if (ALIGN < sizeof(void *) || (ALIGN & (ALIGN - 1)))
+    return EINVAL;
+  if ((p = memalign(ALIGN, NBYTES)) == 0)
+    return ENOMEM;
+  *MEMPTR = p;
+  return 0;
+}
+
+size_t malloc_usable_size(void *APTR) { return regionUsableSpace(APTR); }
+
+/* size queries, see mallocx.h */
+
+#define flagsAlign(FLAGS) ((size_t) 1 << ((FLAGS) & 0x3f))
+
+size_t malloc_good_size(size_t NBYTES) { return requestUsableSpace(NBYTES, 0); }
+
+size_t nallocx(size_t NBYTES, int FLAGS) { return requestUsableSpace(NBYTES, flagsAlign(FLAGS)); }
+
+smallocx_return_t smallocx(size_t NBYTES, int FLAGS) {
+  smallocx_return_t r;
+  size_t align = flagsAlign(FLAGS);
+  r.ptr = align > 8 ? memalign(align, NBYTES) : malloc(NBYTES);
+  r.size = r.ptr ? regionUsableSpace(r.ptr) : 0;
+  if (r.ptr && (FLAGS & MALLOCX_ZERO))
+    memset(r.ptr, 0, r.size);
+  return r;
+}
+
+void *mallocx(size_t NBYTES, int FLAGS) { return smallocx(NBYTES, FLAGS).ptr; }
 
 
 /* some systems require that malloc replacements provide these... */
@@ -0,0 +1,201 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "mallocTrace.h"
+
+/*
+  Allocation trace recording.
+
+  With MYALLOCATOR_TRACE=path, every call through malloc.c appends an
+  event to a ring buffer owned by the calling thread.  Only that thread
+  writes a ring's head and only the flusher thread writes its tail, so
+  recording takes no lock and never waits: if the flusher falls behind
+  and a ring is full, the event is dropped and counted.  The flusher
+  wakes every FLUSH_INTERVAL_NS and appends what each ring holds to the
+  file, so events are in time order per thread but not across threads
+  (traceConvert sorts them).  At exit the rings are flushed once more.
+
+  Rings are mapped directly (we are inside malloc), and a thread's ring
+  is handed to a later thread once the first has exited and the ring
+  has drained.  Frees are recorded before the region is released and
+  allocations after it is obtained, so another thread's reuse of the
+  same address is always stamped later.  A realloc that moves does
+  both at once, so malloc.c records it while holding the allocator's
+  lock (allocatorLock()), after the new region is obtained and before
+  any other thread can get the old one back.
+*/
+
+#define RING_EVENTS 65536	/* power of 2 */
+#define FLUSH_INTERVAL_NS 2000000 /* 2ms */
+
+typedef struct TraceRing_s {
+  TraceEvent_t events[RING_EVENTS];
+  uint64_t head;		/* next event written, by the owner */
+  uint64_t tail;		/* next event flushed, by the flusher */
+  uint64_t dropped;
+  uint32_t thread;
+  int orphan;			/* owner exited: may be adopted once drained */
+  struct TraceRing_s *next;	/* all rings, newest first */
+} TraceRing_t;
+
+int traceState = TRACE_UNKNOWN;
+
+static int traceFd = -1;
+static TraceRing_t *rings = 0;
+static uint32_t nextThread = 0;
+static pthread_t flusher;
+static pthread_mutex_t flushLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t ringKey;
+static int stopping = 0;
+
+static __thread TraceRing_t *myRing = 0;
+static __thread int inTrace = 0;	/* reentrancy guard */
+
+static uint64_t now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void writeAll(const void *buf, size_t n) {
+  while (n > 0) {
+    ssize_t w = write(traceFd, buf, n);
+    if (w <= 0)
+      return;			/* disk full or similar: lose the rest */
+    buf = (const char *) buf + w;
+    n -= w;
+  }
+}
+
+static void flushRing(TraceRing_t *ring) {
+  uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  uint64_t tail = ring->tail;
+  while (tail != head) {	/* at most two contiguous pieces */
+    uint64_t i = tail & (RING_EVENTS - 1);
+    uint64_t n = head - tail;
+    if (n > RING_EVENTS - i)
+      n = RING_EVENTS - i;
+    writeAll(&ring->events[i], n * sizeof(TraceEvent_t));
+    tail += n;
+  }
+  __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+}
+
+static void flushAll() {
+  TraceRing_t *ring;
+  pthread_mutex_lock(&flushLock);
+  for (ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); ring; ring = ring->next)
+    flushRing(ring);
+  pthread_mutex_unlock(&flushLock);
+}
+
+static void *flushLoop(void *arg) {
+  struct timespec interval = { 0, FLUSH_INTERVAL_NS };
+  inTrace = 1;			/* never record the flusher itself */
+  while (!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE)) {
+    flushAll();
+    nanosleep(&interval, 0);
+  }
+  return arg;
+}
+
+static void traceFinish() {
+  TraceRing_t *ring;
+  uint64_t dropped = 0;
+  __atomic_store_n(&traceState, TRACE_OFF, __ATOMIC_RELEASE);
+  __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+  pthread_join(flusher, 0);
+  flushAll();
+  for (ring = rings; ring; ring = ring->next)
+    dropped += ring->dropped;
+  if (dropped)
+    fprintf(stderr, "mallocTrace: dropped %llu events\n", (unsigned long long) dropped);
+  close(traceFd);
+}
+
+static void ringOrphaned(void *ring) { __atomic_store_n(&((TraceRing_t *) ring)->orphan, 1, __ATOMIC_RELEASE); }
+
+/* decide once whether to trace; returns true if tracing */
+int traceStart() {
+  int expected = TRACE_UNKNOWN;
+  const char *path;
+  if (!__atomic_compare_exchange_n(&traceState, &expected, TRACE_STARTING, 0,
+                                   __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    return 0;			/* another thread is deciding: skip this one */
+  inTrace = 1;			/* what we call may allocate */
+  path = getenv("MYALLOCATOR_TRACE");
+  if (path == 0 || (traceFd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0
+      || pthread_key_create(&ringKey, ringOrphaned) != 0) {
+    if (path)
+      fprintf(stderr, "mallocTrace: can't record to %s\n", path);
+    __atomic_store_n(&traceState, TRACE_OFF, __ATOMIC_RELEASE);
+    inTrace = 0;
+    return 0;
+  }
+  writeAll(TRACE_MAGIC, 8);
+  if (pthread_create(&flusher, 0, flushLoop, 0) != 0) {
+    close(traceFd);
+    __atomic_store_n(&traceState, TRACE_OFF, __ATOMIC_RELEASE);
+    inTrace = 0;
+    return 0;
+  }
+  atexit(traceFinish);
+  __atomic_store_n(&traceState, TRACE_ON, __ATOMIC_RELEASE);
+  inTrace = 0;
+  return 1;
+}
+
+static TraceRing_t *newRing() {
+  TraceRing_t *ring;
+  for (ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); ring; ring = ring->next) {
+    int orphan = 1;		/* adopt a drained ring if there is one */
+    if (__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == ring->head
+        && __atomic_compare_exchange_n(&ring->orphan, &orphan, 0, 0,
+                                       __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+      break;
+  }
+  if (ring == 0) {
+    ring = mmap(0, sizeof(TraceRing_t), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED)
+      return 0;
+    ring->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&rings, &ring->next, ring, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+      ;
+  }
+  ring->thread = __atomic_fetch_add(&nextThread, 1, __ATOMIC_RELAXED);
+  pthread_setspecific(ringKey, ring);
+  return ring;
+}
+
+void traceRecord(int op, void *ptr, void *old, size_t size) {
+  TraceRing_t *ring;
+  TraceEvent_t *e;
+  uint64_t head;
+  if (inTrace)
+    return;
+  inTrace = 1;
+  if ((ring = myRing) == 0 && (ring = myRing = newRing()) == 0) {
+    inTrace = 0;
+    return;
+  }
+  head = ring->head;
+  if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == RING_EVENTS) {
+    ring->dropped += 1;		/* full: never wait for the flusher */
+  } else {
+    e = &ring->events[head & (RING_EVENTS - 1)];
+    e->time = now();
+    e->ptr = (uintptr_t) ptr;
+    e->old = (uintptr_t) old;
+    e->size = size;
+    e->thread = ring->thread;
+    e->op = op;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+  }
+  inTrace = 0;
+}
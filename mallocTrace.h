@@ -0,0 +1,41 @@
+#ifndef mallocTrace_H
+#define mallocTrace_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+  Recording of malloc.c's calls (see mallocTrace.c).  Set
+  MYALLOCATOR_TRACE=path to record; traceConvert turns the recording
+  into a replayable trace.
+*/
+
+#define TRACE_MAGIC "MATRACE1"	/* first 8 bytes of a recording */
+
+enum { TRACE_MALLOC = 1, TRACE_FREE, TRACE_REALLOC, TRACE_MEMALIGN };
+
+typedef struct TraceEvent_s {	/* as written to the file */
+  uint64_t time;		/* ns, CLOCK_MONOTONIC */
+  uint64_t ptr;			/* region returned, or freed */
+  uint64_t old;			/* TRACE_REALLOC: the region passed in,
+				   TRACE_MEMALIGN: the alignment */
+  uint64_t size;		/* requested (TRACE_FREE: 0 if not given) */
+  uint32_t thread;		/* small integer per recording thread */
+  uint32_t op;
+} TraceEvent_t;
+
+enum { TRACE_UNKNOWN, TRACE_STARTING, TRACE_OFF, TRACE_ON };
+extern int traceState;
+
+int traceStart(void);
+void traceRecord(int op, void *ptr, void *old, size_t size);
+
+/* record an event if tracing; the first call decides whether it is */
+#define TRACE(op, ptr, old, size)					\
+  do {									\
+    int state_ = __atomic_load_n(&traceState, __ATOMIC_ACQUIRE);	\
+    if (state_ == TRACE_ON || (state_ == TRACE_UNKNOWN && traceStart()))	\
+      traceRecord(op, ptr, old, size);					\
+  } while (0)
+
+#endif // mallocTrace_H
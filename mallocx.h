@@ -0,0 +1,39 @@
+#ifndef mallocx_H
+#define mallocx_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  Size queries provided by malloc.c beside the standard functions, in
+  the style of jemalloc's and macOS's, so that callers sizing vectors
+  and hash tables can use the whole block they get.
+
+  malloc_good_size(n) and nallocx(n, flags) return the usable space a
+  malloc(n) (or mallocx(n, flags)) would get, without allocating.
+  mallocx() allocates like malloc; smallocx() also returns the usable
+  space it granted.  flags is 0 or a combination of:
+*/
+
+#define MALLOCX_LG_ALIGN(la) ((int) (la))	/* align to 2^la */
+#define MALLOCX_ALIGN(a) ((int) (__builtin_ffsl(a) - 1)) /* a: a power of 2 */
+#define MALLOCX_ZERO ((int) 0x40)		/* zero the region */
+
+typedef struct {
+  void *ptr;
+  size_t size;			/* usable space, 0 if ptr is */
+} smallocx_return_t;
+
+size_t malloc_good_size(size_t n);
+size_t nallocx(size_t n, int flags);
+void *mallocx(size_t n, int flags);
+smallocx_return_t smallocx(size_t n, int flags);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // mallocx_H
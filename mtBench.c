@@ -0,0 +1,281 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "myAllocator.h"
+#include "perfCounters.h"
+
+/*
+  Multithreaded allocator benchmarks.
+
+  Each workload runs with 1, 2, 4 ... maxThreads threads, first against
+  the replacement malloc (malloc.c on top of myAllocator) and then
+  against glibc's malloc, reached through __libc_malloc & friends, so
+  both are measured in the same process.
+
+    larson:   each thread keeps a table of live blocks and repeatedly
+              replaces a random one with a block of a random size
+              (server-style churn); halfway through, threads swap
+              tables so blocks are freed by a thread that didn't
+              allocate them
+    threadtest: each thread allocates a batch of fixed-size blocks
+              and then frees all of them, over and over
+    prodcons: threads are paired; producers malloc, consumers free
+              what they receive through a single-producer queue
+    mixed:    like larson but with sizes drawn from a skewed mix of
+              small, medium and occasional large requests
+
+  usage: mtBench [-t maxThreads] [-n pairsPerThread] [-c] [-p]
+  -c prints CSV instead of a table.
+  -p also counts cycles, instructions, L1d/LLC/dTLB misses and page
+     faults around each run (perfCounters.c) and prints them per
+     operation (a malloc or a free); "-" where the kernel won't count.
+*/
+
+extern void *__libc_malloc(size_t);
+extern void __libc_free(void *);
+
+typedef struct Allocator_s {
+  const char *name;
+  void *(*alloc)(size_t);
+  void (*release)(void *);
+} Allocator_t;
+
+static Allocator_t allocators[] = {
+  { "myAllocator", malloc, free },
+  { "glibc", __libc_malloc, __libc_free },
+};
+#define NALLOCATORS (sizeof(allocators) / sizeof(allocators[0]))
+
+#define TABLE_SIZE 256		/* live blocks per larson/mixed thread */
+#define BATCH_SIZE 256		/* blocks per threadtest round */
+#define QUEUE_SIZE 256		/* prodcons queue capacity */
+
+typedef struct Worker_s {
+  pthread_t thread;
+  int id;
+  long ops;			/* malloc/free pairs to perform */
+  long pairs;			/* ...and actually performed */
+  long failures;		/* allocations that returned 0 */
+  unsigned long long rng;
+  Allocator_t *a;
+  void **table;			/* larson/mixed live blocks */
+  struct Worker_s *peer;	/* prodcons partner or larson successor */
+  void *_Atomic *queue;		/* prodcons: producer -> consumer ring */
+  _Atomic long head, tail;
+} Worker_t;
+
+static pthread_barrier_t swapBarrier;
+
+static unsigned long long nextRandom(Worker_t *w) { /* xorshift64 */
+  w->rng ^= w->rng << 13;
+  w->rng ^= w->rng >> 7;
+  w->rng ^= w->rng << 17;
+  return w->rng;
+}
+
+static size_t uniformSize(Worker_t *w) { return 16 + nextRandom(w) % 241; } /* 16..256 */
+
+static size_t mixedSize(Worker_t *w) {
+  unsigned r = nextRandom(w) % 100;
+  if (r < 80)
+    return 8 + nextRandom(w) % 57;	/* 8..64 */
+  else if (r < 98)
+    return 64 + nextRandom(w) % 961;	/* 64..1K */
+  else
+    return 1024 + nextRandom(w) % 7169; /* 1K..8K */
+}
+
+static void *allocTouch(Worker_t *w, size_t s) {
+  char *p = w->a->alloc(s);
+  if (p)
+    p[0] = p[s - 1] = (char)s;	/* touch both ends like a real user */
+  else
+    w->failures++;
+  return p;
+}
+
+static void churn(Worker_t *w, size_t (*sizeFn)(Worker_t *)) {
+  long i;
+  for (i = 0; i < TABLE_SIZE; i++)
+    w->table[i] = allocTouch(w, sizeFn(w));
+  for (i = 0; i < w->ops; i++) {
+    int k = nextRandom(w) % TABLE_SIZE;
+    if (i == w->ops / 2) {	/* hand our table to the next thread */
+      void **t;
+      pthread_barrier_wait(&swapBarrier);
+      t = w->peer->table;
+      pthread_barrier_wait(&swapBarrier);
+      w->table = t;
+    }
+    w->a->release(w->table[k]);
+    w->table[k] = allocTouch(w, sizeFn(w));
+  }
+  for (i = 0; i < TABLE_SIZE; i++)
+    w->a->release(w->table[i]);
+  w->pairs = w->ops;
+}
+
+static void *larson(void *arg) { churn(arg, uniformSize); return 0; }
+static void *mixed(void *arg) { churn(arg, mixedSize); return 0; }
+
+static void *threadtest(void *arg) {
+  Worker_t *w = arg;
+  void *batch[BATCH_SIZE];
+  long done;
+  int i;
+  for (done = 0; done < w->ops; done += BATCH_SIZE) {
+    for (i = 0; i < BATCH_SIZE; i++)
+      batch[i] = allocTouch(w, 64);
+    for (i = 0; i < BATCH_SIZE; i++)
+      w->a->release(batch[i]);
+  }
+  w->pairs = done;
+  return 0;
+}
+
+/* even ids produce into their own queue, odd ids drain their partner's */
+static void *prodcons(void *arg) {
+  Worker_t *w = arg;
+  long i;
+  if (w->id % 2 == 0) {
+    for (i = 0; i < w->ops; i++) {
+      long t = atomic_load_explicit(&w->tail, memory_order_relaxed);
+      void *p = allocTouch(w, uniformSize(w));
+      while (t - atomic_load_explicit(&w->head, memory_order_acquire) == QUEUE_SIZE)
+        sched_yield();		/* queue full */
+      atomic_store_explicit(&w->queue[t % QUEUE_SIZE], p, memory_order_relaxed);
+      atomic_store_explicit(&w->tail, t + 1, memory_order_release);
+    }
+    w->pairs = w->ops;		/* the consumer's frees complete these pairs */
+  } else {
+    Worker_t *prod = w->peer;
+    for (i = 0; i < prod->ops; i++) {
+      long h = atomic_load_explicit(&prod->head, memory_order_relaxed);
+      while (atomic_load_explicit(&prod->tail, memory_order_acquire) == h)
+        sched_yield();		/* queue empty */
+      w->a->release(atomic_load_explicit(&prod->queue[h % QUEUE_SIZE], memory_order_relaxed));
+      atomic_store_explicit(&prod->head, h + 1, memory_order_release);
+    }
+  }
+  return 0;
+}
+
+typedef struct Workload_s {
+  const char *name;
+  void *(*run)(void *);
+  int minThreads;		/* prodcons needs a pair */
+} Workload_t;
+
+static Workload_t workloads[] = {
+  { "larson", larson, 1 },
+  { "threadtest", threadtest, 1 },
+  { "prodcons", prodcons, 2 },
+  { "mixed", mixed, 1 },
+};
+#define NWORKLOADS (sizeof(workloads) / sizeof(workloads[0]))
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1.0e-9 * ts.tv_nsec;
+}
+
+/* returns elapsed wall time; totals go to *pairs and *failures, and
+   event counts to counts if pc isn't 0 */
+static double runWorkload(Workload_t *wl, Allocator_t *a, int nthreads, long ops,
+                          long *pairs, long *failures,
+                          PerfCounters_t *pc, unsigned long long *counts) {
+  Worker_t *w = calloc(nthreads, sizeof(Worker_t));
+  double t0, t1;
+  int i;
+  pthread_barrier_init(&swapBarrier, 0, nthreads);
+  for (i = 0; i < nthreads; i++) {
+    w[i].id = i;
+    w[i].ops = ops;
+    w[i].rng = 0x9e3779b97f4a7c15ULL * (i + 1);
+    w[i].a = a;
+    w[i].table = calloc(TABLE_SIZE, sizeof(void *));
+    w[i].queue = calloc(QUEUE_SIZE, sizeof(void *));
+    w[i].peer = (wl->run == prodcons) ? &w[i ^ 1] : &w[(i + 1) % nthreads];
+  }
+  if (pc)
+    perfStart(pc);
+  t0 = now();
+  for (i = 0; i < nthreads; i++)
+    pthread_create(&w[i].thread, 0, wl->run, &w[i]);
+  for (i = 0; i < nthreads; i++)
+    pthread_join(w[i].thread, 0);
+  t1 = now();
+  if (pc)
+    perfStop(pc, counts);
+  *pairs = *failures = 0;
+  for (i = 0; i < nthreads; i++) {
+    *pairs += w[i].pairs;
+    *failures += w[i].failures;
+    free(w[i].queue);
+  }
+  for (i = 0; i < nthreads; i++)	/* tables were swapped, free them all afterwards */
+    free(w[i].table);
+  pthread_barrier_destroy(&swapBarrier);
+  free(w);
+  return t1 - t0;
+}
+
+int main(int argc, char **argv)
+{
+  int maxThreads = 4, csv = 0, perf = 0, opt, nthreads, i;
+  long ops = 20000;
+  size_t wi, ai;
+  PerfCounters_t pc;
+  unsigned long long counts[PERF_NCOUNTERS];
+  while ((opt = getopt(argc, argv, "t:n:cp")) != -1) {
+    switch (opt) {
+    case 't': maxThreads = atoi(optarg); break;
+    case 'n': ops = atol(optarg); break;
+    case 'c': csv = 1; break;
+    case 'p': perf = 1; break;
+    default:
+      fprintf(stderr, "usage: %s [-t maxThreads] [-n pairsPerThread] [-c] [-p]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (perf && perfOpen(&pc) == 0)
+    fprintf(stderr, "%s: no event counters available (see perf_event_paranoid)\n", argv[0]);
+  if (csv)
+    printf("workload,threads,allocator,seconds,mops,failures");
+  else
+    printf("%-10s %7s %-12s %9s %9s %8s", "workload", "threads", "allocator", "seconds", "Mops/s", "failures");
+  for (i = 0; perf && i < PERF_NCOUNTERS; i++)
+    printf(csv ? ",%s/op" : " %12s/op", perfCounterNames[i]);
+  printf("\n");
+  for (wi = 0; wi < NWORKLOADS; wi++) {
+    Workload_t *wl = &workloads[wi];
+    for (nthreads = wl->minThreads; nthreads <= maxThreads; nthreads *= 2) {
+      for (ai = 0; ai < NALLOCATORS; ai++) {
+        long pairs, failures;
+        double secs = runWorkload(wl, &allocators[ai], nthreads, ops, &pairs, &failures,
+                                  perf ? &pc : 0, counts);
+        double mops = 2.0 * pairs / secs / 1.0e6; /* a malloc and a free per pair */
+        if (csv)
+          printf("%s,%d,%s,%f,%f,%ld", wl->name, nthreads, allocators[ai].name, secs, mops, failures);
+        else
+          printf("%-10s %7d %-12s %9.3f %9.3f %8ld", wl->name, nthreads, allocators[ai].name, secs, mops, failures);
+        for (i = 0; perf && i < PERF_NCOUNTERS; i++) {
+          if (counts[i] == PERF_UNAVAILABLE)
+            printf(csv ? ",-" : " %15s", "-");
+          else
+            printf(csv ? ",%.3f" : " %15.3f", counts[i] / (2.0 * pairs));
+        }
+        printf("\n");
+        fflush(stdout);
+      }
+    }
+  }
+  if (perf)
+    perfClose(&pc);
+  return 0;
+}
@@ -1,9 +1,22 @@
+#define _GNU_SOURCE		/* PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP */
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <assert.h>
 #include <unistd.h>
 #include <limits.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
 #include "myAllocator.h"
+#include "allocatorInternal.h"
+#include "allocLatency.h"
+#include "buddyAlloc.h"
+#include "freeTable.h"
+#include "guardedAlloc.h"
+#include "handleAlloc.h"
+#include "pageMap.h"
+#include "tinyAlloc.h"
 
 /*
   This is a simple endogenous first-fit allocator.  
@@ -21,10 +34,12 @@
   suffix (extent - (prefixSize+suffixSize) is computed by
   usableSpace().  
 
-  All blocks are allocated from an arena extending from arenaBegin to
-  arenaEnd.  In particular, the first block's prefix is at address
-  arenaBegin, and the last block's suffix is at address
-  arenaEnd-suffixSize. 
+  All blocks are allocated from an arena made of chunks, each its own
+  mapping.  Chunks need not be contiguous, so each one starts and ends
+  with a sentinel: an allocated block with no usable space that no
+  free block can coalesce with (see newChunk()).  Chunk sizes double,
+  from DEFAULT_CHUNKSIZE up to MAX_CHUNKSIZE, so a large heap takes few
+  mappings.
 
   This allocator generally refers to a block by the address of its
   prefix.  The address of the prefix to block b's successor is the
@@ -34,7 +49,8 @@
   computePrevSuffixAddr(), getNextPrefix(), getPrefPrefix().
 
   The method findFirstFit() searches the arena for a sufficiently
-  large free block.  Adjacent free blocks can be coalesced:  See
+  large free block, using the table of free blocks' sizes kept by
+  freeTable.c rather than walking the blocks themselves.  Adjacent free blocks can be coalesced:  See
   coalescePrev(),   coalesce().  
 
   Functions regionToBlock() and blockToRegion() convert between
@@ -42,67 +58,225 @@
 
   FindFirstAllocRegion() uses findFirstFit to locate a suffiently
   large unallocated bock.  This block will be split if it contains
-  sufficient excess space to create another free block.  FreeRegion
+  sufficient excess space to create another free block (see
+  splitBlock(), MIN_SPLIT).  bestFitAllocRegion() is the same with
+  findBestFit(); both are fitAllocRegionLocked().  FreeRegion
   marks the region's allocated block as free and attempts to coalesce
   it with its neighbors.
 
  */
 
-/* align everything to multiples of 8 */
-#define align8(x) (((x)+7) & ~7)
-#define prefixSize align8(sizeof(BlockPrefix_t))
-#define suffixSize align8(sizeof(BlockSuffix_t))
+/* everything is aligned to multiples of 8: align8(), prefixSize &
+   suffixSize are in allocatorInternal.h */
 
-/* how much memory to ask for */
-const size_t DEFAULT_BRKSIZE = 0x100000;	/* 1M */
+/* how much memory to ask for: the first chunk, doubling up to the max */
+const size_t DEFAULT_CHUNKSIZE = 0x100000;	/* 1M */
+const size_t MAX_CHUNKSIZE = 0x4000000;	/* 64M */
+
+/* requests at least this large get their own mapping; from BUDDY_MIN
+   up to it they get a buddy block */
+const size_t DEFAULT_MMAP_THRESHOLD = BUDDY_MAX;	/* 1M */
+
+/* the smallest free block worth splitting off: a prefix, a suffix and
+   a little usable space */
+#define MIN_SPLIT (prefixSize + suffixSize + 8)
+
+/* regions that must not share a cache line are aligned & padded to this */
+#define CACHE_LINE 64
+
+/* requests up to this size are cache-line aligned & padded (0: none) */
+size_t cacheAlignMaxSize = 0;
 
 /* create a block, mark it as free */
 BlockPrefix_t *makeFreeBlock(void *addr, size_t size) { 
   BlockPrefix_t *p = addr;
   void *limitAddr = addr + size;
   BlockSuffix_t *s = limitAddr - align8(sizeof(BlockSuffix_t));
-  p->suffix = s;
-  s->prefix = p;
+  p->suffix = (void *) s - addr;
+  s->prefix = p->suffix;
   p->allocated = 0;
   return p;
 }
 
-/* lowest & highest address in arena (global vars) */
-BlockPrefix_t *arenaBegin = (void *)0;
-void *arenaEnd = 0;
+/* the arena's chunks; header, first sentinel, blocks, last sentinel */
+typedef struct ArenaChunk_s {
+    struct ArenaChunk_s *next;
+    size_t size;		/* of the whole mapping */
+    size_t used;		/* extent of its allocated blocks */
+    Span_t span;		/* its pages in the page map */
+} ArenaChunk_t;
+
+#define chunkHeaderSize align8(sizeof(ArenaChunk_t))
+#define sentinelSize (prefixSize + suffixSize)
+
+static ArenaChunk_t *chunks = 0;	/* newest first, 0 until initialized */
+static size_t arenaUsed = 0, arenaCapacity = 0; /* sums of chunks' used & capacity */
+static size_t nextChunkSize;
+static size_t pageSize;
+
+#define pageRound(x) alignUp((size_t)(x), pageSize)
+#define pageTrunc(x) ((size_t)(x) & ~(pageSize - 1))
+
+static BlockPrefix_t *chunkFirstBlock(ArenaChunk_t *c) {
+    return (void *) c + chunkHeaderSize + sentinelSize;
+}
+
+static BlockPrefix_t *chunkLastSentinel(ArenaChunk_t *c) {
+    return (void *) c + c->size - sentinelSize;
+}
+
+static size_t chunkCapacity(ArenaChunk_t *c) { /* room for blocks */
+    return c->size - chunkHeaderSize - 2 * sentinelSize;
+}
+
+/* the chunk holding p, or 0 if p has a mapping of its own */
+static ArenaChunk_t *chunkOf(BlockPrefix_t *p) {
+    Span_t *span = pageMapLookup(p);
+    return span && span->kind == SPAN_ARENA ? span->begin : 0;
+}
+
+static void makeSentinel(void *addr) {
+    makeFreeBlock(addr, sentinelSize)->allocated = BLOCK_ALLOCATED | BLOCK_SENTINEL;
+}
+
+/* map a chunk whose free block holds at least s bytes, return that block */
+static BlockPrefix_t *newChunk(size_t s) {
+    size_t size = nextChunkSize;
+    size_t need = pageRound(chunkHeaderSize + 3 * sentinelSize + align8(s));
+    ArenaChunk_t *c;
+    BlockPrefix_t *p;
+    if (size < need)
+        size = need;
+    c = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (c == MAP_FAILED)
+        return 0;
+    c->size = size;
+    c->used = 0;
+    c->span.kind = SPAN_ARENA;
+    c->span.begin = c;
+    c->span.length = size;
+    if (!pageMapSet(c, size, &c->span)) {
+        munmap(c, size);
+        return 0;
+    }
+    makeSentinel((void *) c + chunkHeaderSize);
+    makeSentinel(chunkLastSentinel(c));
+    p = makeFreeBlock(chunkFirstBlock(c), (void *) chunkLastSentinel(c) - (void *) chunkFirstBlock(c));
+    freeTableInsert(p);
+    c->next = chunks;
+    chunks = c;
+    arenaCapacity += chunkCapacity(c);
+    if (nextChunkSize < MAX_CHUNKSIZE)
+        nextChunkSize *= 2;
+    noteHeapGrowth(size);
+    return p;
+}
+
+/*
+  Accounting.  Every allocated block records in its prefix how much of
+  its usable space the caller didn't ask for (slack), so freeing it can
+  take exactly the requested bytes back out of allocatorStats.  Other
+  backends report through the same note*() hooks (allocatorInternal.h).
+*/
+AllocatorStats_t allocatorStats;
+
+void noteHeapGrowth(size_t s) {
+    allocatorStats.heapBytes += s;
+    if (allocatorStats.heapBytes > allocatorStats.peakHeapBytes)
+	allocatorStats.peakHeapBytes = allocatorStats.heapBytes;
+}
+
+void noteHeapShrink(size_t s) {
+    allocatorStats.heapBytes -= s;
+}
+
+void noteRegionAllocated(size_t requested, size_t usable, size_t metadata) {
+    allocatorStats.liveBytes += requested;
+    allocatorStats.usableBytes += usable;
+    allocatorStats.metadataBytes += metadata;
+    allocatorStats.liveBlocks += 1;
+    if (allocatorStats.liveBytes > allocatorStats.peakLiveBytes)
+	allocatorStats.peakLiveBytes = allocatorStats.liveBytes;
+}
+
+void noteRegionFreed(size_t requested, size_t usable, size_t metadata) {
+    allocatorStats.liveBytes -= requested;
+    allocatorStats.usableBytes -= usable;
+    allocatorStats.metadataBytes -= metadata;
+    allocatorStats.liveBlocks -= 1;
+}
+
+void noteAllocated(BlockPrefix_t *p, size_t s) {
+    size_t usable = computeUsableSpace(p);
+    size_t slack = usable - s;
+    ArenaChunk_t *c = chunkOf(p);
+    p->slack = slack < UINT_MAX ? slack : UINT_MAX;
+    noteRegionAllocated(usable - p->slack, usable, prefixSize + suffixSize);
+    if (c) {                    /* for regionDefragHint() */
+        c->used += prefixSize + usable + suffixSize;
+        arenaUsed += prefixSize + usable + suffixSize;
+    }
+}
+
+void noteFreed(BlockPrefix_t *p) {
+    size_t usable = computeUsableSpace(p);
+    ArenaChunk_t *c = chunkOf(p);
+    noteRegionFreed(usable - p->slack, usable, prefixSize + suffixSize);
+    if (c) {
+        c->used -= prefixSize + usable + suffixSize;
+        arenaUsed -= prefixSize + usable + suffixSize;
+    }
+}
+
+static int allocatorReserveLocked(size_t bytes, int flags);
 
 void initializeArena() {
-    if (arenaBegin != 0)	/* only initialize once */
+    if (chunks != 0)		/* only initialize once */
 	return; 
-    arenaBegin = makeFreeBlock(sbrk(DEFAULT_BRKSIZE), DEFAULT_BRKSIZE);
-    arenaEnd = ((void *)arenaBegin) + DEFAULT_BRKSIZE;
+    pageSize = sysconf(_SC_PAGESIZE);
+    nextChunkSize = DEFAULT_CHUNKSIZE;
+    if (newChunk(0) == 0) {
+	fprintf(stderr, "myAllocator: can't map the arena\n");
+	abort();
+    }
+    if (getenv("MYALLOCATOR_STATS"))	/* report at exit */
+	atexit(printAllocatorStats);
+#ifdef ALLOC_LATENCY
+    atexit(printAllocatorLatency);	/* built to measure: always report */
+#endif
+    guardedInit();
+    if (getenv("MYALLOCATOR_CACHE_ALIGN"))
+	cacheAlignMaxSize = strtoul(getenv("MYALLOCATOR_CACHE_ALIGN"), 0, 0);
+    if (getenv("MYALLOCATOR_RESERVE")) /* as if allocatorReserve() came first */
+	allocatorReserveLocked(strtoul(getenv("MYALLOCATOR_RESERVE"), 0, 0),
+			       RESERVE_PREFAULT | RESERVE_CLASSES);
 }
 
 size_t computeUsableSpace(BlockPrefix_t *p) { /* useful space within a block */
     void *prefix_end = ((void*)p) + prefixSize;
-    return ((void *)(p->suffix)) - (prefix_end);
+    return ((void *)blockSuffix(p)) - (prefix_end);
 }
 
 BlockPrefix_t *computeNextPrefixAddr(BlockPrefix_t *p) { 
-    return ((void *)(p->suffix)) + suffixSize;
+    return ((void *)blockSuffix(p)) + suffixSize;
 }
 
 BlockSuffix_t *computePrevSuffixAddr(BlockPrefix_t *p) {
     return ((void *)p) - suffixSize;
 }
 
-BlockPrefix_t *getNextPrefix(BlockPrefix_t *p) { /* return addr of next block (prefix), or 0 if last */
+BlockPrefix_t *getNextPrefix(BlockPrefix_t *p) { /* return addr of next block (prefix), or 0 if last in its chunk */
     BlockPrefix_t *np = computeNextPrefixAddr(p);
-    if ((void*)np < (void *)arenaEnd)
+    if (!(np->allocated & BLOCK_SENTINEL))
 	return np;
     else
 	return (BlockPrefix_t *)0;
 }
 
-BlockPrefix_t *getPrevPrefix(BlockPrefix_t *p) { /* return addr of prev block, or 0 if first */
-    BlockSuffix_t *ps = computePrevSuffixAddr(p);
-    if ((void *)ps > (void *)arenaBegin)
-	return ps->prefix;
+BlockPrefix_t *getPrevPrefix(BlockPrefix_t *p) { /* return addr of prev block, or 0 if first in its chunk */
+    BlockPrefix_t *pp = blockPrefix(computePrevSuffixAddr(p));
+    if (!(pp->allocated & BLOCK_SENTINEL))
+	return pp;
     else
 	return (BlockPrefix_t *)0;
 }
@@ -110,7 +284,9 @@ BlockPrefix_t *getPrevPrefix(BlockPrefix_t *p) { /* return addr of prev block, o
 BlockPrefix_t *coalescePrev(BlockPrefix_t *p) {	/* coalesce p with prev, return prev if coalesced, otherwise p */
     BlockPrefix_t *prev = getPrevPrefix(p);
     if (p && prev && (!p->allocated) && (!prev->allocated)) {
+	freeTableRemove(p);	/* p disappears into prev */
 	makeFreeBlock(prev, ((void *)computeNextPrefixAddr(p)) - (void *)prev);
+	freeTableUpdate(prev);
 	return prev;
     }
     return p;
@@ -127,93 +303,101 @@ void coalesce(BlockPrefix_t *p) {	/* coalesce p with prev & next */
     }
 }
 
-int growingDisabled = 1;	/* true: don't grow arena! (needed for cygwin) */
+int growingDisabled = 0;	/* true: don't grow arena beyond its first chunk */
 
-BlockPrefix_t *growArena(size_t s) { /* this won't work under cygwin since runtime uses brk()!! */
-    void *n;
+BlockPrefix_t *growArena(size_t s) { /* add a chunk, return its free block */
     BlockPrefix_t *p;
+    LATENCY_START(t);
     if (growingDisabled)
 	return (BlockPrefix_t *)0;
-    s += (prefixSize + suffixSize);
-    if (s < DEFAULT_BRKSIZE)
-	s = DEFAULT_BRKSIZE;
-    n = sbrk(s);
-    if ((n == 0) || (n != arenaEnd)) /* fail if brk moved or failed! */
-	return 0;
-    arenaEnd = n + s;		/* new end */
-    p = makeFreeBlock(n, s);	/* create new block */
-    p = coalescePrev(p);	/* coalesce with old arena end  */
+    p = newChunk(s);
+    LATENCY_RECORD(LATENCY_GROW, t);
     return p;
 }
 
 
 int pcheck(void *p) {		/* check that pointer is within arena */
-    return (p >= (void *)arenaBegin && p < (void *)arenaEnd);
-}
-
-
-void arenaCheck() {		/* consistency check */
-    BlockPrefix_t *p = arenaBegin;
-    size_t amtFree = 0, amtAllocated = 0;
-    int numBlocks = 0;
-    while (p != 0) {		/* walk through arena */
-        fprintf(stderr, "  checking from %p, size=%8zd, allocated=%d...\n",
-            p, computeUsableSpace(p), p->allocated);
-        assert(pcheck(p));	/* p must remain within arena */
-        assert(pcheck(p->suffix)); /* suffix must be within arena */
-        assert(p->suffix->prefix == p);	/* suffix should reference prefix */
-        if (p->allocated) 	/* update allocated & free space */
-            amtAllocated += computeUsableSpace(p);
-        else
-            amtFree += computeUsableSpace(p);
-        numBlocks += 1;
-        p = computeNextPrefixAddr(p);
-        if (p == arenaEnd) {
-            break;
-        } else {
-            assert(pcheck(p));
-        }
+    Span_t *span = pageMapLookup(p);
+    return span && span->kind == SPAN_ARENA;
+}
+
+
+static void arenaCheckLocked() {		/* consistency check */
+    ArenaChunk_t *c;
+    size_t amtFree = 0, amtAllocated = 0, arenaSize = 0;
+    int numBlocks = 0, numFree = 0, numChunks = 0;
+    for (c = chunks; c != 0; c = c->next) { /* walk through each chunk */
+	BlockPrefix_t *p = chunkFirstBlock(c);
+	BlockPrefix_t *last = chunkLastSentinel(c);
+	size_t used = 0;
+	assert(blockPrefix(computePrevSuffixAddr(p))->allocated & BLOCK_SENTINEL);
+	assert(last->allocated & BLOCK_SENTINEL);
+	while (p != last) {
+	    fprintf(stderr, "  checking from %p, size=%8zd, allocated=%d...\n",
+		p, computeUsableSpace(p), p->allocated);
+	    assert(p > (BlockPrefix_t *) c && p < last); /* p must remain within its chunk */
+	    assert((void *) blockSuffix(p) < (void *) last); /* and so must its suffix */
+	    assert(blockPrefix(blockSuffix(p)) == p);	/* suffix should reference prefix */
+	    assert(pageMapLookup(p) == &c->span); /* page map must agree */
+	    assert(!(p->allocated & BLOCK_SENTINEL));
+	    assert(!(p->allocated & BLOCK_MOVABLE) || handleHolds(p)); /* its handle must lead back */
+	    if (p->allocated) {	/* update allocated & free space */
+		amtAllocated += computeUsableSpace(p);
+		used += (void *) computeNextPrefixAddr(p) - (void *) p;
+	    } else {
+		amtFree += computeUsableSpace(p);
+		assert(freeTableHolds(p)); /* free blocks must be in the table */
+		numFree += 1;
+	    }
+	    numBlocks += 1;
+	    p = computeNextPrefixAddr(p);
+	}
+	assert(used == c->used);	/* chunk occupancy must agree */
+	numChunks += 1;
+	arenaSize += c->size;
     }
     fprintf(stderr,
-	    " mcheck: numBlocks=%d, amtAllocated=%zdk, amtFree=%zdk, arenaSize=%zdk\n",
+	    " mcheck: numBlocks=%d, amtAllocated=%zdk, amtFree=%zdk, arenaSize=%zdk, chunks=%d\n",
 	    numBlocks,
 	    (size_t)amtAllocated / 1024LL,
 	    (size_t)amtFree/1024LL,
-	    ((size_t)arenaEnd - (size_t)arenaBegin) / 1024);
+	    arenaSize / 1024, numChunks);
+    assert(numFree == freeTableCount()); /* ...and nothing else */
+    tinyCheck();
+    buddyCheck();
 }
 
-BlockPrefix_t *findFirstFit(size_t s) {    /* find first block with usable space > s */
-    BlockPrefix_t *p = arenaBegin;
-    while (p) {
-        if (!p->allocated && computeUsableSpace(p) >= s)
-            return p;
-        p = getNextPrefix(p);
-    }
+/* a free block with usable space >= s, found by search (one of
+   freeTable.c's fits), or else a new chunk's */
+static inline __attribute__((always_inline)) BlockPrefix_t *findFit(size_t s, BlockPrefix_t *(*search)(size_t)) {
+    BlockPrefix_t *p = search(s);
+    if (p)
+        return p;
     return growArena(s);
 }
 
-BlockPrefix_t *findBestFit(size_t s) {
-    BlockPrefix_t *p = arenaBegin;
-    BlockPrefix_t *bestFit = NULL;
-    int minUsableSpace = INT_MAX;
-    while (p) {
-        if (!p->allocated){
-            int space = (int) computeUsableSpace(p);
-            if (space == s){
-                return p;
-            } else {
-                if (space < minUsableSpace && space > s){
-                    minUsableSpace = space;
-                    bestFit = p;
-                }
-            }
-        }
-        p = getNextPrefix(p);
-    }
-    if (bestFit){
-        return bestFit;
+BlockPrefix_t *findFirstFit(size_t s) { return findFit(s, freeTableFirstFit); }
+
+BlockPrefix_t *findBestFit(size_t s) { return findFit(s, freeTableBestFit); }
+
+/* carve an allocated block's first asize bytes of usable space out of
+   free block p (already out of the free table); the rest becomes a
+   free block if it is at least MIN_SPLIT bytes, else stays as slack */
+static void splitBlock(BlockPrefix_t *p, size_t asize) {
+    if (computeUsableSpace(p) >= asize + MIN_SPLIT) {
+        void *freeSliverStart = (void *) p + prefixSize + suffixSize + asize;
+        void *freeSliverEnd = computeNextPrefixAddr(p);
+        freeTableInsert(makeFreeBlock(freeSliverStart, freeSliverEnd - freeSliverStart));
+        makeFreeBlock(p, freeSliverStart - (void *) p); /* piece being allocated */
     }
-    return growArena(s);
+}
+
+/* allocate free block p for a region of requested bytes, asize of them usable */
+static void allocateBlock(BlockPrefix_t *p, size_t asize, size_t requested) {
+    freeTableRemove(p);
+    splitBlock(p, asize);
+    p->allocated = BLOCK_ALLOCATED;
+    noteAllocated(p, requested);
 }
 
 /* conversion between blocks & regions (offset of prefixSize */
@@ -233,57 +417,485 @@ void *prefixToRegion(BlockPrefix_t *p) {
     return 0;
 }
 
-/* these really are equivalent to malloc & free */
-void *firstFitAllocRegion(size_t s) {
-  size_t asize = align8(s);
-  BlockPrefix_t *p;
-  if (arenaBegin == 0)		/* arena uninitialized? */
-    initializeArena();
-  p = findFirstFit(s);		/* find a block */
-  if (p) {			/* found a block */
-    size_t availSize = computeUsableSpace(p);
-    if (availSize >= (asize + prefixSize + suffixSize + 8)) { /* split block? */
-      void *freeSliverStart = (void *)p + prefixSize + suffixSize + asize;
-      void *freeSliverEnd = computeNextPrefixAddr(p);
-      makeFreeBlock(freeSliverStart, freeSliverEnd - freeSliverStart);
-      makeFreeBlock(p, freeSliverStart - (void *)p); /* piece being allocated */
+/*
+  Large blocks.  A request of DEFAULT_MMAP_THRESHOLD or more gets a
+  mapping of its own that holds exactly one block, marked BLOCK_MAPPED;
+  the mapping starts at the page containing the prefix and ends right
+  after the suffix.  Freeing unmaps it, and resizing it uses mremap(),
+  which moves page table entries instead of copying the payload.  Each
+  has its own span in the page map, covering the pages up to its
+  region's first byte.
+*/
+static void *mapLargeRegion(size_t align, size_t s) {
+    size_t asize = align8(s);
+    size_t extra = align > 8 ? align : 0;   /* room to slide the region up */
+    size_t len = pageRound(prefixSize + asize + suffixSize + extra);
+    void *m = mmap(0, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    void *r, *begin, *end;
+    BlockPrefix_t *p;
+    Span_t *span;
+    if (m == MAP_FAILED)
+        return 0;
+    r = extra ? (void *) alignUp((size_t) m + prefixSize, align) : m + prefixSize;
+    p = regionToPrefix(r);
+    begin = (void *) pageTrunc(p);
+    end = (void *) pageRound(r + asize + suffixSize);
+    if (begin > m)              /* give back what the alignment skipped */
+        munmap(m, begin - m);
+    if (m + len > end)
+        munmap(end, (m + len) - end);
+    if ((span = spanNew(SPAN_MAPPED, begin, end - begin)) == 0 || !pageMapSet(begin, r + 1 - begin, span)) {
+        if (span)
+            spanDelete(span);
+        munmap(begin, end - begin);
+        return 0;
     }
-    p->allocated = 1;		/* mark as allocated */
-    return prefixToRegion(p);	/* convert to *region */
-  } else {			/* failed */
-    return (void *)0;
-  }
-  
+    makeFreeBlock(p, end - (void *) p);
+    p->allocated = BLOCK_ALLOCATED | BLOCK_MAPPED;
+    noteHeapGrowth(end - begin);
+    noteAllocated(p, s);
+    return r;
 }
 
-/* these really are equivalent to malloc & free */
-void *bestFitAllocRegion(size_t s) {
+static void unmapLargeRegion(BlockPrefix_t *p) {
+    void *begin = (void *) pageTrunc(p);
+    void *end = computeNextPrefixAddr(p);
+    Span_t *span = pageMapLookup(p);
+    noteFreed(p);
+    noteHeapShrink(end - begin);
+    pageMapClear(begin, prefixToRegion(p) + 1 - begin);
+    spanDelete(span);
+    munmap(begin, end - begin);
+}
+
+static void *remapLargeRegion(BlockPrefix_t *p, size_t newSize) {
+    void *begin = (void *) pageTrunc(p);
+    size_t offset = (void *) p - begin;
+    size_t oldLen = (void *) computeNextPrefixAddr(p) - begin;
+    size_t newLen = pageRound(offset + prefixSize + align8(newSize) + suffixSize);
+    size_t headLen = offset + prefixSize + 1; /* what the page map covers */
+    Span_t *span = pageMapLookup(p);
+    int grown = p->allocated & BLOCK_GROWN; /* makeFreeBlock() clears it */
+    void *m;
+    noteFreed(p);
+    if ((m = mremap(begin, oldLen, newLen, MREMAP_MAYMOVE)) == MAP_FAILED) {
+        noteAllocated(p, computeUsableSpace(p) - p->slack); /* unchanged */
+        return 0;
+    }
+    if (m != begin) {           /* moved: so do its page map entries */
+        pageMapClear(begin, headLen);
+        if (!pageMapSet(m, headLen, span)) { /* no way back: the old pages are gone */
+            fprintf(stderr, "myAllocator: can't map pages at %p\n", m);
+            abort();
+        }
+    }
+    span->begin = m;
+    span->length = newLen;
+    p = makeFreeBlock(m + offset, newLen - offset);
+    p->allocated = BLOCK_ALLOCATED | BLOCK_MAPPED | grown;
+    noteHeapShrink(oldLen);
+    noteHeapGrowth(newLen);
+    noteAllocated(p, newSize);
+    return prefixToRegion(p);
+}
+
+static void *cacheAlignedAllocRegionLocked(size_t s);
+
+/*
+  these really are equivalent to malloc; they differ only in how the
+  arena's free blocks are searched.  fitAllocRegionLocked() is always
+  inlined and the search is a constant at each call, so a build with
+  optimization (-O1 and up) makes the search a direct call.  The
+  Makefile's default -g build doesn't propagate the constant and
+  calls it through the pointer.
+*/
+static inline __attribute__((always_inline)) void *fitAllocRegionLocked(size_t s, BlockPrefix_t *(*search)(size_t)) {
     size_t asize = align8(s);
     BlockPrefix_t *p;
-    if (arenaBegin == 0)        /* arena uninitialized? */
+    if (chunks == 0)        /* arena uninitialized? */
         initializeArena();
-    p = findBestFit(s);        /* find a block */
+    if (guardedSampleRate && guardedShouldSample(s)) { /* sampled: put it next to a guard page */
+        void *r = guardedAlloc(s);
+        if (r)
+            return r;
+    }
+    if (s <= cacheAlignMaxSize)    /* keep it off other regions' cache lines */
+        return cacheAlignedAllocRegionLocked(s);
+    if (s <= TINY_ADAPTIVE_MAX) {   /* tiny: a headerless slot in a run, if a class fits */
+        void *r = tinyAlloc(s);
+        if (r)
+            return r;
+    }
+    if (s >= DEFAULT_MMAP_THRESHOLD)    /* large: a mapping of its own */
+        return mapLargeRegion(8, s);
+    if (s >= BUDDY_MIN) {       /* medium: a buddy block of 2^k pages */
+        void *r = buddyAlloc(s);
+        if (r)
+            return r;
+        asize = buddyBlockSize(s);  /* region full: as much room, see requestUsableSpace() */
+    }
+    LATENCY_START(t);
+    p = findFit(asize, search);        /* find a block */
     if (p) {            /* found a block */
-        size_t availSize = computeUsableSpace(p);
-        if (availSize >= (asize + prefixSize + suffixSize + 8)) { /* split block? */
-            void *freeSliverStart = (void *) p + prefixSize + suffixSize + asize;
-            void *freeSliverEnd = computeNextPrefixAddr(p);
-            makeFreeBlock(freeSliverStart, freeSliverEnd - freeSliverStart);
-            makeFreeBlock(p, freeSliverStart - (void *) p); /* piece being allocated */
+#ifdef ALLOC_LATENCY
+        size_t availSize = computeUsableSpace(p); /* to tell a split from a whole block */
+#endif
+        allocateBlock(p, asize, s);
+        LATENCY_RECORD(computeUsableSpace(p) < availSize ? LATENCY_SPLIT : LATENCY_FAST_HIT, t);
+        return prefixToRegion(p);    /* convert to *region */
+    } else {            /* failed */
+        return (void *) 0;
+    }
+}
+
+static void *firstFitAllocRegionLocked(size_t s) { return fitAllocRegionLocked(s, freeTableFirstFit); }
+
+static void *bestFitAllocRegionLocked(size_t s) { return fitAllocRegionLocked(s, freeTableBestFit); }
+
+/* an arena block with s bytes of usable space, whatever s is (never
+   tiny, buddy or mapped), for handleAlloc.c's movable regions */
+BlockPrefix_t *arenaAllocBlock(size_t s, size_t requested) {
+    BlockPrefix_t *p;
+    if (chunks == 0)        /* arena uninitialized? */
+        initializeArena();
+    if ((p = findFirstFit(align8(s))) != 0)
+        allocateBlock(p, align8(s), requested);
+    return p;
+}
+
+/* like firstFitAllocRegion, but the region starts on a multiple of
+   align (a power of 2).  Any gap in front of the aligned region is
+   split off as its own free block, so it must be large enough to hold
+   a prefix, a suffix and a little usable space. */
+static void *alignedAllocRegionLocked(size_t align, size_t s) {
+    size_t asize = align8(s);
+    size_t minGap = MIN_SPLIT;
+    BlockPrefix_t *p;
+    if (align <= 8)             /* every region is already 8-aligned */
+        return firstFitAllocRegionLocked(s);
+    if (chunks == 0)        /* arena uninitialized? */
+        initializeArena();
+    if (s >= DEFAULT_MMAP_THRESHOLD)    /* large: a mapping of its own */
+        return mapLargeRegion(align, s);
+    p = findFirstFit(asize + align + minGap); /* room for the worst-case gap */
+    if (p) {
+        void *r = prefixToRegion(p);
+        void *ar = (void *) alignUp((size_t) r, align);
+        if (ar != r) {          /* split off the leading gap */
+            void *blockEnd = computeNextPrefixAddr(p);
+            BlockPrefix_t *ap;
+            if (ar - r < minGap)
+                ar = (void *) alignUp((size_t) r + minGap, align);
+            ap = regionToPrefix(ar);
+            makeFreeBlock(p, (void *) ap - (void *) p); /* gap stays free */
+            freeTableUpdate(p);
+            p = makeFreeBlock(ap, blockEnd - (void *) ap);
+        } else {
+            freeTableRemove(p);
         }
-        p->allocated = 1;        /* mark as allocated */
+        splitBlock(p, asize);
+        p->allocated = BLOCK_ALLOCATED;        /* mark as allocated */
+        noteAllocated(p, s);
         return prefixToRegion(p);    /* convert to *region */
     } else {            /* failed */
         return (void *) 0;
     }
 }
 
-void freeRegion(void *r) {
-    if (r != 0) {
-        BlockPrefix_t *p = regionToPrefix(r); /* convert to block */
-        p->allocated = 0;    /* mark as free */
-        coalesce(p);
+/*
+  A region that shares no cache line with any other region: it starts
+  on a line boundary and is padded to whole lines, so the next block's
+  prefix starts on a fresh line.  Only its own prefix sits in the line
+  before it, and that is written just on allocation and free.  Used for
+  per-thread data that would otherwise suffer false sharing.
+*/
+static void *cacheAlignedAllocRegionLocked(size_t s) {
+    void *r = alignedAllocRegionLocked(CACHE_LINE, alignUp(s, CACHE_LINE));
+    if (r) {                    /* account for what was asked, not the padding */
+        noteFreed(regionToPrefix(r));
+        noteAllocated(regionToPrefix(r), s);
     }
+    return r;
+}
+
+/*
+  Reserving.  The arena starts small and grows on demand, so without
+  this a process takes its page faults and mmap()s during its first
+  real requests.  allocatorReserve(bytes, flags) does that work up
+  front: it initializes the arena and adds a chunk unless bytes are
+  already free in it; with RESERVE_PREFAULT it faults every arena page
+  in, and with RESERVE_MLOCK it locks them too (which also faults them
+  in).  RESERVE_CLASSES readies a tiny run per size class and a buddy
+  top block the same way.  Chunks added later are not prefaulted.
+*/
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23	/* Linux 5.14 */
+#endif
+
+int reserveRange(void *addr, size_t length, int flags) {
+    if (flags & RESERVE_MLOCK)
+        return mlock(addr, length);
+    if ((flags & RESERVE_PREFAULT) && madvise(addr, length, MADV_POPULATE_WRITE) != 0) {
+        size_t off;             /* older kernel: touch each page */
+        for (off = 0; off < length; off += pageSize) /* (atomically: it may be in use) */
+            __atomic_fetch_add((char *) addr + off, 0, __ATOMIC_RELAXED);
+    }
+    return 0;
+}
+
+static int allocatorReserveLocked(size_t bytes, int flags) {
+    ArenaChunk_t *c;
+    if (chunks == 0)            /* arena uninitialized? */
+        initializeArena();
+    if (arenaCapacity - arenaUsed < bytes && newChunk(bytes) == 0)
+        return -1;
+    for (c = chunks; c != 0; c = c->next)
+        if (reserveRange(c, c->size, flags) != 0)
+            return -1;
+    if ((flags & RESERVE_CLASSES) && (tinyReserve(flags) != 0 || buddyReserve(flags) != 0))
+        return -1;
+    return 0;
+}
+
+/* which backend r came from (SPAN_*), 0 if not from this allocator */
+static int regionKind(void *r) {
+    Span_t *span = pageMapLookup(r);
+    return span ? span->kind : 0;
+}
+
+int ownsRegion(void *r) { return regionKind(r) != 0; }
+
+/*
+  Hints for an application that defragments by moving regions itself
+  (allocate a copy, free the original), like jemalloc's utilization
+  query behind Redis's active defrag.  occ (if not 0) tells how full
+  r's container is: its tiny run, arena chunk or buddy top block, and
+  all containers of that kind together.  The answer is true if r's
+  container is emptier than its kind on average (and, for tiny runs,
+  isn't the run new slots come from), so moving r out of it packs its
+  kind tighter and brings that container closer to being given back:
+  a tiny run or buddy block as soon as it empties, an arena chunk by
+  compactArena().  Regions with a mapping or guard slot of their own
+  are never worth moving.
+*/
+static int regionDefragHintLocked(void *r, RegionOccupancy_t *occ) {
+    RegionOccupancy_t o = { 0, 0, 0, 0 };
+    int hint = 0;
+    ArenaChunk_t *c;
+    switch (regionKind(r)) {
+    case SPAN_TINY:
+        hint = tinyOccupancy(r, &o);
+        break;
+    case SPAN_BUDDY:
+        hint = buddyOccupancy(r, &o);
+        break;
+    case SPAN_ARENA:
+        c = chunkOf(regionToPrefix(r));
+        o.containerUsed = c->used;
+        o.containerSize = chunkCapacity(c);
+        o.kindUsed = arenaUsed;
+        o.kindSize = arenaCapacity;
+        hint = (double) o.containerUsed / o.containerSize < (double) o.kindUsed / o.kindSize;
+        break;
+    case SPAN_MAPPED:
+    case SPAN_GUARDED:
+        o.containerUsed = o.containerSize = o.kindUsed = o.kindSize = regionUsableSpace(r);
+        break;
+    }
+    if (occ)
+        *occ = o;
+    return hint;
+}
+
+void arenaFreeBlock(BlockPrefix_t *p) {
+    noteFreed(p);
+    p->allocated = 0;       /* mark as free */
+    freeTableInsert(p);
+    LATENCY_START(t);
+    coalesce(p);
+    LATENCY_RECORD(LATENCY_COALESCE, t);
+}
+
+static void freeRegionLocked(void *r) {
+    if (r == 0)
+        return;
+    switch (regionKind(r)) {
+    case SPAN_TINY:
+        tinyFree(r);
+        break;
+    case SPAN_GUARDED:
+        guardedFree(r);
+        break;
+    case SPAN_BUDDY:
+        buddyFree(r);
+        break;
+    case SPAN_MAPPED:
+        unmapLargeRegion(regionToPrefix(r));
+        break;
+    case SPAN_ARENA:
+        arenaFreeBlock(regionToPrefix(r));
+        break;
+    default:
+        fprintf(stderr, "myAllocator: free of %p, which it didn't allocate\n", r);
+        abort();
+    }
+}
+
+/*
+  usable space a region from firstFitAllocRegion(s) (or, if align isn't
+  more than 8, alignedAllocRegion(align, s)) will have at least, without
+  allocating it, so callers can size their buffers to use it all.
+  It follows the same routing: cache-aligned sizes are padded to whole
+  lines, medium sizes get a whole buddy block, large ones whole pages,
+  the rest align8().  Arena blocks may come with a little more (a
+  remainder too small to split off), and sampled guarded regions, which
+  end at their guard page, get just align8(s).
+*/
+static size_t requestUsableSpaceLocked(size_t s, size_t align) {
+    if (chunks == 0)        /* arena uninitialized? */
+        initializeArena();
+    if (align > 8)          /* the aligned path doesn't pad */
+        return align8(s);
+    if (s <= cacheAlignMaxSize)
+        return alignUp(s, CACHE_LINE);
+    if (s >= DEFAULT_MMAP_THRESHOLD)
+        return pageRound(prefixSize + align8(s) + suffixSize) - prefixSize - suffixSize;
+    if (s >= BUDDY_MIN)
+        return buddyBlockSize(s);
+    if (s <= TINY_ADAPTIVE_MAX && tinySlotSize(s))
+        return tinySlotSize(s);
+    return align8(s);
+}
+
+/*
+  Compaction.  Raw regions can't move, but movable ones (BLOCK_MOVABLE,
+  see handleAlloc.c) can: in each chunk, a movable block that follows a
+  free block and isn't pinned slides down over it, taking its prefix &
+  suffix along (they only hold offsets), and the free space moves up
+  behind it, where it coalesces with whatever free block follows.  So
+  free space gathers between the raw regions and the pinned ones, and at
+  the end of each chunk.  Then a chunk left entirely free is unmapped
+  (unless it is the only one), and a free block at the end of a chunk
+  gives back its whole pages.
+*/
+static size_t trimChunk(ArenaChunk_t *c) { /* returns bytes given back */
+    BlockPrefix_t *last = chunkLastSentinel(c);
+    BlockPrefix_t *f = blockPrefix(computePrevSuffixAddr(last));
+    size_t keep, trimmed;
+    if (f->allocated)         /* (a sentinel if c is empty) */
+        return 0;
+    keep = pageRound((void *) f - (void *) c + MIN_SPLIT + sentinelSize);
+    if (keep >= c->size)
+        return 0;
+    trimmed = c->size - keep;
+    pageMapClear((void *) c + keep, trimmed);
+    munmap((void *) c + keep, trimmed);
+    arenaCapacity -= trimmed;
+    c->size = keep;
+    c->span.length = keep;
+    makeSentinel(chunkLastSentinel(c));
+    makeFreeBlock(f, (void *) chunkLastSentinel(c) - (void *) f);
+    freeTableUpdate(f);
+    noteHeapShrink(trimmed);
+    return trimmed;
+}
+
+static size_t compactArenaLocked() {
+    ArenaChunk_t *c, **link;
+    size_t returned = 0;
+    if (chunks == 0)          /* arena uninitialized? */
+        return 0;
+    for (c = chunks; c != 0; c = c->next) {
+        BlockPrefix_t *p, *n;
+        for (p = chunkFirstBlock(c); (n = getNextPrefix(p)) != 0; p = n) {
+            if (!p->allocated && (n->allocated & BLOCK_MOVABLE) && !handlePinned(n)) {
+                size_t freeExtent = (void *) n - (void *) p;
+                size_t extent = (void *) computeNextPrefixAddr(n) - (void *) n;
+                freeTableRemove(p);
+                memmove(p, n, extent);
+                handleMoved(p);
+                n = makeFreeBlock((void *) p + extent, freeExtent);
+                freeTableInsert(n);
+                coalesce(n);      /* with the next block, if free */
+            }
+        }
+    }
+    for (link = &chunks; (c = *link) != 0; ) {
+        BlockPrefix_t *first = chunkFirstBlock(c);
+        if (!first->allocated && computeNextPrefixAddr(first) == chunkLastSentinel(c)
+            && (c != chunks || c->next != 0)) { /* empty, and not the only chunk */
+            *link = c->next;
+            arenaCapacity -= chunkCapacity(c);
+            freeTableRemove(first);
+            pageMapClear(c, c->size);
+            noteHeapShrink(c->size);
+            returned += c->size;
+            munmap(c, c->size);
+        } else {
+            returned += trimChunk(c);
+            link = &c->next;
+        }
+    }
+    return returned;
+}
+
+/* usable space of any region this allocator handed out */
+size_t regionUsableSpace(void *r) {
+    switch (regionKind(r)) {
+    case SPAN_TINY:
+        return tinyUsableSpace(r);
+    case SPAN_GUARDED:
+        return guardedUsableSpace(r);
+    case SPAN_BUDDY:
+        return buddyUsableSpace(r);
+    case SPAN_ARENA:
+    case SPAN_MAPPED:
+        return computeUsableSpace(regionToPrefix(r));
+    }
+    return 0;                   /* not ours */
+}
+
+/*
+  like freeRegion(r), but the caller also passes the size it requested
+  (C++14 sized delete, C23 free_sized).  A tiny or buddy size goes
+  straight to its backend once r is seen to lie in that backend's
+  region, a range compare instead of the page-map walk.  Other regions
+  take the usual path; for an arena block the size tells us where r's
+  successor most likely starts, so we prefetch that prefix before
+  touching our own and the two cache misses overlap.
+*/
+static void freeSizedRegionLocked(void *r, size_t s) {
+    if (r == 0)
+        return;
+    if (s <= TINY_ADAPTIVE_MAX && tinyOwns(r)) {
+        tinyFree(r);
+    } else if (s >= BUDDY_MIN && s < DEFAULT_MMAP_THRESHOLD && buddyOwns(r)) {
+        buddyFree(r);
+    } else {
+        if (s > TINY_MAX && s < BUDDY_MIN)
+            __builtin_prefetch(r + align8(s) + suffixSize, 1);
+        freeRegionLocked(r);
+    }
+}
+
+/*
+  room for a block that must move to grow again: an arena block or a
+  mapping of room bytes, accounted as newSize requested.  Not a tiny,
+  buddy or guarded region, which couldn't keep BLOCK_GROWN and would
+  count the whole room as requested.
+*/
+static void *growRoomLocked(size_t room, size_t newSize) {
+    BlockPrefix_t *p;
+    void *r;
+    if (room >= DEFAULT_MMAP_THRESHOLD) {
+        if ((r = mapLargeRegion(8, room)) != 0) {
+            noteFreed(regionToPrefix(r));
+            noteAllocated(regionToPrefix(r), newSize);
+        }
+        return r;
+    }
+    p = arenaAllocBlock(room, newSize);
+    return p ? prefixToRegion(p) : 0;
 }
 
 /*
@@ -292,38 +904,90 @@ void freeRegion(void *r) {
    1. checking if the present region has sufficient available space to
    satisfy the request (if so, do nothing)
    2. allocating a new region of sufficient size & copying the data
+   Blocks with their own mapping that stay large are resized with
+   mremap() instead, so their payload is never copied.
+   A block that had to move to grow is marked BLOCK_GROWN; if it must
+   move to grow again it gets twice its old size (or newSize if more),
+   so an append loop copies O(log n) times instead of O(n).  The slack
+   goes back when the block is freed (or, if it got its own mapping,
+   shrinks below a quarter), and when the doubled size can't be had,
+   newSize is tried instead.
    TODO: if the successor 's' to r's block is free, and there is sufficient space in r + s, then just adjust sizes of r & s.
 */
-void *resizeRegion(void *r, size_t newSize) {
-    int oldSize;
+static void *resizeRegionLocked(void *r, size_t newSize) {
+    size_t oldSize;
+    int kind = r ? regionKind(r) : SPAN_ARENA;
+    if (kind == SPAN_TINY || kind == SPAN_GUARDED || kind == SPAN_BUDDY) { /* no prefix: move unless the slot is big enough */
+        size_t oldUsable = regionUsableSpace(r);
+        void *n;
+        LATENCY_START(t);
+        if (kind == SPAN_TINY && tinyResize(r, newSize))
+            return r;
+        if (kind == SPAN_BUDDY && buddyResize(r, newSize))
+            return r;
+        if ((n = firstFitAllocRegionLocked(newSize)) != 0) {
+            memcpy(n, r, oldUsable < newSize ? oldUsable : newSize);
+            freeRegionLocked(r);
+            LATENCY_RECORD(LATENCY_REALLOC_COPY, t);
+        }
+        return n;
+    }
     if (r != (void *) 0)        /* old region existed */
-        oldSize = (int) computeUsableSpace(regionToPrefix(r));
+        oldSize = computeUsableSpace(regionToPrefix(r));
     else
         oldSize = 0;        /* non-existant regions have size 0 */
 
-    if (oldSize >= newSize)    /* old region is big enough */
+    if (kind == SPAN_MAPPED) {
+        if (newSize >= DEFAULT_MMAP_THRESHOLD) /* stays large: no copy */
+            return remapLargeRegion(regionToPrefix(r), newSize);
+        if ((regionToPrefix(r)->allocated & BLOCK_GROWN) /* keep the room it was given */
+            && newSize <= oldSize && newSize > oldSize / 4) {
+            noteFreed(regionToPrefix(r));
+            noteAllocated(regionToPrefix(r), newSize);
+            return r;
+        }
+        oldSize = newSize;      /* shrinks into the arena: copy what's kept */
+    } else if (oldSize >= newSize) {    /* old region is big enough */
+        if (r != (void *) 0) {     /* (and newSize is its new requested size) */
+            noteFreed(regionToPrefix(r));
+            noteAllocated(regionToPrefix(r), newSize);
+        }
         return r;
-    else {            /* allocate new region & copy old data */
-
-        char *o = (char *) r;    /* treat both regions as char* */
-        char *n = (char *) firstFitAllocRegion(newSize);
-        int i;
-        for (i = 0; i < oldSize; i++) /* copy byte-by-byte, should use memcpy */
-            n[i] = o[i];
-        freeRegion(o);        /* free old region */
-        return (void *) n;
-
+    }
+    {            /* allocate new region & copy old data */
+        LATENCY_START(t);
+        int growing = kind == SPAN_ARENA && r != 0;
+        void *n = 0;
+        if (growing && (regionToPrefix(r)->allocated & BLOCK_GROWN) && 2 * oldSize > newSize)
+            n = growRoomLocked(2 * oldSize, newSize); /* grown before: leave room */
+        if (n == 0)
+            n = firstFitAllocRegionLocked(newSize);
+        if (n) {        /* on failure r stays valid, like realloc */
+            memcpy(n, r, oldSize);
+            freeRegionLocked(r);        /* free old region */
+            if (growing && (regionKind(n) == SPAN_ARENA || regionKind(n) == SPAN_MAPPED))
+                regionToPrefix(n)->allocated |= BLOCK_GROWN;
+            LATENCY_RECORD(LATENCY_REALLOC_COPY, t);
+        }
+        return n;
     }
 }
 
-void *optimizedResizeRegion(void *r, size_t newSize) {
+static void *optimizedResizeRegionLocked(void *r, size_t newSize) {
     int oldSize;
+    if (r && regionKind(r) != SPAN_ARENA)
+        return resizeRegionLocked(r, newSize);
     if (r != (void *) 0)        /* old region existed */
         oldSize = (int) computeUsableSpace(regionToPrefix(r));
     else
         oldSize = 0;        /* non-existant regions have size 0 */
-    if (oldSize >= newSize)    /* old region is big enough */
+    if (oldSize >= newSize) {    /* old region is big enough */
+        if (r != (void *) 0) {     /* (and newSize is its new requested size) */
+            noteFreed(regionToPrefix(r));
+            noteAllocated(regionToPrefix(r), newSize);
+        }
         return r;
+    }
     else {            /* allocate new region & copy old data */
         int sumSize;
         BlockPrefix_t* nextBlock = getNextPrefix(regionToPrefix(r));
@@ -350,11 +1014,194 @@ void *optimizedResizeRegion(void *r, size_t newSize) {
             }
         }
         char *o = (char *) r;    /* treat both regions as char* */
-        char *n = (char *) firstFitAllocRegion(newSize);
+        char *n = (char *) firstFitAllocRegionLocked(newSize);
         int i;
         for (i = 0; i < oldSize; i++) /* copy byte-by-byte, should use memcpy */
             n[i] = o[i];
-        freeRegion(o);        /* free old region */
+        freeRegionLocked(o);        /* free old region */
         return (void *) n;
     }
-}
\ No newline at end of file
+}
+
+/*
+  The entry points below may be called from several threads at once,
+  so each one holds arenaLock while it runs the *Locked version above.
+  The lock is recursive because arenaCheck()'s fprintf may itself call
+  malloc when malloc.c replaces it.
+*/
+static pthread_mutex_t arenaLock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+
+/* for callers that must do something atomically with an allocator
+   call, such as malloc.c recording a realloc */
+void allocatorLock() { pthread_mutex_lock(&arenaLock); }
+
+void allocatorUnlock() { pthread_mutex_unlock(&arenaLock); }
+
+void arenaCheck() {
+    pthread_mutex_lock(&arenaLock);
+    arenaCheckLocked();
+    pthread_mutex_unlock(&arenaLock);
+}
+
+void *firstFitAllocRegion(size_t s) {
+    void *r;
+    pthread_mutex_lock(&arenaLock);
+    r = firstFitAllocRegionLocked(s);
+    pthread_mutex_unlock(&arenaLock);
+    return r;
+}
+
+void *bestFitAllocRegion(size_t s) {
+    void *r;
+    pthread_mutex_lock(&arenaLock);
+    r = bestFitAllocRegionLocked(s);
+    pthread_mutex_unlock(&arenaLock);
+    return r;
+}
+
+void *alignedAllocRegion(size_t align, size_t s) {
+    void *r;
+    pthread_mutex_lock(&arenaLock);
+    r = alignedAllocRegionLocked(align, s);
+    pthread_mutex_unlock(&arenaLock);
+    return r;
+}
+
+void *cacheAlignedAllocRegion(size_t s) {
+    void *r;
+    pthread_mutex_lock(&arenaLock);
+    r = cacheAlignedAllocRegionLocked(s);
+    pthread_mutex_unlock(&arenaLock);
+    return r;
+}
+
+void freeRegion(void *r) {
+    pthread_mutex_lock(&arenaLock);
+    freeRegionLocked(r);
+    pthread_mutex_unlock(&arenaLock);
+}
+
+void freeSizedRegion(void *r, size_t s) {
+    pthread_mutex_lock(&arenaLock);
+    freeSizedRegionLocked(r, s);
+    pthread_mutex_unlock(&arenaLock);
+}
+
+void *resizeRegion(void *r, size_t newSize) {
+    pthread_mutex_lock(&arenaLock);
+    r = resizeRegionLocked(r, newSize);
+    pthread_mutex_unlock(&arenaLock);
+    return r;
+}
+
+Handle_t hAlloc(size_t s) {
+    Handle_t h;
+    pthread_mutex_lock(&arenaLock);
+    h = hAllocLocked(s);
+    pthread_mutex_unlock(&arenaLock);
+    return h;
+}
+
+void *hLock(Handle_t h) {
+    void *r;
+    pthread_mutex_lock(&arenaLock);
+    r = hLockLocked(h);
+    pthread_mutex_unlock(&arenaLock);
+    return r;
+}
+
+void hUnlock(Handle_t h) {
+    pthread_mutex_lock(&arenaLock);
+    hUnlockLocked(h);
+    pthread_mutex_unlock(&arenaLock);
+}
+
+void hFree(Handle_t h) {
+    pthread_mutex_lock(&arenaLock);
+    hFreeLocked(h);
+    pthread_mutex_unlock(&arenaLock);
+}
+
+int allocatorReserve(size_t bytes, int flags) {
+    int r;
+    pthread_mutex_lock(&arenaLock);
+    r = allocatorReserveLocked(bytes, flags);
+    pthread_mutex_unlock(&arenaLock);
+    return r;
+}
+
+int regionDefragHint(void *r, RegionOccupancy_t *occ) {
+    int hint;
+    pthread_mutex_lock(&arenaLock);
+    hint = regionDefragHintLocked(r, occ);
+    pthread_mutex_unlock(&arenaLock);
+    return hint;
+}
+
+/* refit the tiny size classes to the sizes requested so far, now
+   rather than at the next tuning interval */
+void tuneSizeClasses() {
+    pthread_mutex_lock(&arenaLock);
+    tinyTune();
+    pthread_mutex_unlock(&arenaLock);
+}
+
+size_t compactArena() {
+    size_t returned;
+    pthread_mutex_lock(&arenaLock);
+    returned = compactArenaLocked();
+    pthread_mutex_unlock(&arenaLock);
+    return returned;
+}
+
+size_t requestUsableSpace(size_t s, size_t align) {
+    pthread_mutex_lock(&arenaLock);
+    s = requestUsableSpaceLocked(s, align);
+    pthread_mutex_unlock(&arenaLock);
+    return s;
+}
+
+void *optimizedResizeRegion(void *r, size_t newSize) {
+    pthread_mutex_lock(&arenaLock);
+    r = optimizedResizeRegionLocked(r, newSize);
+    pthread_mutex_unlock(&arenaLock);
+    return r;
+}
+
+void getAllocatorStats(AllocatorStats_t *stats) {
+    pthread_mutex_lock(&arenaLock);
+    *stats = allocatorStats;
+    pthread_mutex_unlock(&arenaLock);
+}
+
+void getAllocatorLatency(int path, unsigned long long counts[LATENCY_BUCKETS]) {
+    pthread_mutex_lock(&arenaLock);
+    latencyCopy(path, counts);
+    pthread_mutex_unlock(&arenaLock);
+}
+
+void printAllocatorLatency() {
+    pthread_mutex_lock(&arenaLock);
+    latencyPrint();
+    pthread_mutex_unlock(&arenaLock);
+}
+
+double allocatorUtilization() {
+    AllocatorStats_t st;
+    getAllocatorStats(&st);
+    return st.peakHeapBytes ? (double) st.peakLiveBytes / st.peakHeapBytes : 0.0;
+}
+
+void printAllocatorStats() {
+    AllocatorStats_t st;
+    struct rusage usage;
+    getAllocatorStats(&st);
+    getrusage(RUSAGE_SELF, &usage);
+    fprintf(stderr,
+	    " allocator: live=%zdk (peak %zdk) in %zd blocks, usable=%zdk, metadata=%zdk\n"
+	    " allocator: heap=%zdk (peak %zdk), utilization=%.1f%%, maxrss=%ldk\n",
+	    st.liveBytes / 1024, st.peakLiveBytes / 1024, st.liveBlocks,
+	    st.usableBytes / 1024, st.metadataBytes / 1024,
+	    st.heapBytes / 1024, st.peakHeapBytes / 1024,
+	    100.0 * allocatorUtilization(), usage.ru_maxrss);
+}
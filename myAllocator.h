@@ -1,21 +1,98 @@
 #ifndef myAllocator_H
 #define myAllocator_H
 
-/* block prefix & suffix */
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* block prefix & suffix; they find each other by offset, not address,
+   so blocks stay valid wherever their memory is mapped */
 typedef struct BlockPrefix_s {
-  struct BlockSuffix_s *suffix;
+  size_t suffix;		/* suffix's distance after the prefix */
   int allocated;
+  union {
+    unsigned int slack;		/* allocated: usable space minus bytes requested */
+    unsigned int freeIndex;	/* free: its entry in the free-block table */
+  };
 } BlockPrefix_t;
 
 typedef struct BlockSuffix_s {
-  struct BlockPrefix_s *prefix;
+  size_t prefix;		/* prefix's distance before the suffix */
 } BlockSuffix_t;
 
+#define blockSuffix(p) ((BlockSuffix_t *) ((char *) (p) + (p)->suffix))
+#define blockPrefix(s) ((BlockPrefix_t *) ((char *) (s) - (s)->prefix))
+
+/* allocator-wide accounting, see getAllocatorStats() */
+typedef struct AllocatorStats_s {
+  size_t liveBytes;		/* bytes requested by live allocations */
+  size_t peakLiveBytes;
+  size_t usableBytes;		/* usable space of their blocks (>= liveBytes) */
+  size_t metadataBytes;		/* prefixes & suffixes of live blocks */
+  size_t liveBlocks;
+  size_t heapBytes;		/* memory obtained for the heap */
+  size_t peakHeapBytes;
+} AllocatorStats_t;
+
+/* how full the run, chunk or buddy block holding a region is, and all
+   of its kind, see regionDefragHint() */
+typedef struct RegionOccupancy_s {
+  size_t containerUsed;		/* bytes in use in r's container */
+  size_t containerSize;
+  size_t kindUsed;		/* ...and in all containers of its kind */
+  size_t kindSize;
+} RegionOccupancy_t;
+
+/* a movable region: *h is where it is now (see handleAlloc.c) */
+typedef void **Handle_t;
+
+/* latency histograms, recorded only when built with -DALLOC_LATENCY */
+enum {
+  LATENCY_FAST_HIT, LATENCY_SPLIT, LATENCY_COALESCE, LATENCY_GROW,
+  LATENCY_REALLOC_COPY, LATENCY_PATHS
+};
+#define LATENCY_BUCKETS 64	/* bucket i: [2^i, 2^(i+1)) ticks */
+
+/* allocatorReserve() flags */
+#define RESERVE_PREFAULT 1	/* fault the pages in now */
+#define RESERVE_MLOCK 2		/* ...and keep them in RAM */
+#define RESERVE_CLASSES 4	/* also ready a tiny run per class & a buddy block */
+
+extern size_t cacheAlignMaxSize;	/* cacheAligned for requests up to this */
+
 void arenaCheck(void);
+void allocatorLock(void);		/* hold off other threads' calls */
+void allocatorUnlock(void);
+int allocatorReserve(size_t bytes, int flags);	/* 0 if ok, else -1 & errno */
+void getAllocatorStats(AllocatorStats_t *stats);
+double allocatorUtilization(void);	/* peakLiveBytes / peakHeapBytes */
+void printAllocatorStats(void);
+void getAllocatorLatency(int path, unsigned long long counts[LATENCY_BUCKETS]);
+void printAllocatorLatency(void);
 void *firstFitAllocRegion(size_t s);
+void *bestFitAllocRegion(size_t s);
+void *alignedAllocRegion(size_t align, size_t s);
+void *cacheAlignedAllocRegion(size_t s);	/* shares no cache line */
 void freeRegion(void *r);
+void freeSizedRegion(void *r, size_t s);
 void *resizeRegion(void *r, size_t newSize);
 size_t computeUsableSpace(BlockPrefix_t *p);
+size_t regionUsableSpace(void *r);
+size_t requestUsableSpace(size_t s, size_t align); /* before allocating */
+int ownsRegion(void *r);		/* r came from this allocator? */
+int regionDefragHint(void *r, RegionOccupancy_t *occ); /* worth moving? */
+void tuneSizeClasses(void);		/* refit tiny classes to requests seen */
+Handle_t hAlloc(size_t s);
+void *hLock(Handle_t h);		/* pin *h until hUnlock() */
+void hUnlock(Handle_t h);
+void hFree(Handle_t h);
+size_t compactArena(void);		/* returns bytes given back */
 BlockPrefix_t *regionToPrefix(void *r);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif // myAllocator_H
@@ -0,0 +1,166 @@
+#ifndef myAllocator_HPP
+#define myAllocator_HPP
+
+/*
+  C++ bindings for myAllocator.
+
+  ArenaResource: a std::pmr::memory_resource that allocates from the
+  arena, so pmr containers can be pointed at it.
+
+  Allocator<T, Fit>: a stateless STL allocator over the same arena, for
+  containers that take an allocator template argument.  Fit is the
+  policy that searches the arena, FirstFit (the default) or BestFit;
+  it is fixed at compile time, so choosing it costs nothing per call.
+
+  Replacement operator new/delete (plain, array, nothrow, sized and
+  aligned overloads) are emitted by exactly one translation unit of the
+  program, the one that does
+
+      #define MYALLOCATOR_REPLACE_NEW
+      #include "myAllocator.hpp"
+
+  (replacement allocation functions may not be inline, so they can't
+  simply live in every includer).
+
+  Sized deallocations go through freeSizedRegion(); over-aligned
+  requests go through alignedAllocRegion().
+*/
+
+#include <cstddef>
+#include <limits>
+#include <memory_resource>
+#include <new>
+
+#include "myAllocator.h"
+
+namespace myAllocator {
+
+/* the arena hands out 8-aligned regions; anything stricter is special */
+constexpr std::size_t arenaAlignment = 8;
+
+/* see cacheAlignedAllocRegion() */
+constexpr std::size_t cacheLineSize = 64;
+
+/* fit policies: how an allocation searches the arena's free blocks */
+struct FirstFit {
+  static void *allocate(std::size_t bytes) { return firstFitAllocRegion(bytes); }
+};
+
+struct BestFit {
+  static void *allocate(std::size_t bytes) { return bestFitAllocRegion(bytes); }
+};
+
+template <class Fit = FirstFit>
+inline void *allocRegion(std::size_t bytes, std::size_t align) {
+  return align > arenaAlignment ? alignedAllocRegion(align, bytes)
+                                : Fit::allocate(bytes);
+}
+
+class ArenaResource : public std::pmr::memory_resource {
+protected:
+  void *do_allocate(std::size_t bytes, std::size_t align) override {
+    void *p = allocRegion(bytes, align);
+    if (p == nullptr)
+      throw std::bad_alloc();
+    return p;
+  }
+
+  void do_deallocate(void *p, std::size_t bytes, std::size_t) override {
+    freeSizedRegion(p, bytes);
+  }
+
+  /* there is only one arena, so any two ArenaResources are interchangeable */
+  bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+    return dynamic_cast<const ArenaResource *>(&other) != nullptr;
+  }
+};
+
+/* like std::pmr::new_delete_resource() */
+inline ArenaResource *arenaResource() noexcept {
+  static ArenaResource resource;
+  return &resource;
+}
+
+template <class T, class Fit = FirstFit>
+struct Allocator {
+  typedef T value_type;
+
+  Allocator() noexcept = default;
+  template <class U> Allocator(const Allocator<U, Fit> &) noexcept {}
+
+  T *allocate(std::size_t n) {
+    void *p;
+    if (n > std::numeric_limits<std::size_t>::max() / sizeof(T))
+      throw std::bad_array_new_length();
+    if ((p = allocRegion<Fit>(n * sizeof(T), alignof(T))) == nullptr)
+      throw std::bad_alloc();
+    return static_cast<T *>(p);
+  }
+
+  void deallocate(T *p, std::size_t n) noexcept {
+    freeSizedRegion(p, n * sizeof(T));
+  }
+};
+
+/* all fits free into the same arena, so any two Allocators are equal */
+template <class T, class F, class U, class G>
+bool operator==(const Allocator<T, F> &, const Allocator<U, G> &) noexcept { return true; }
+template <class T, class F, class U, class G>
+bool operator!=(const Allocator<T, F> &, const Allocator<U, G> &) noexcept { return false; }
+
+} // namespace myAllocator
+
+#ifdef MYALLOCATOR_REPLACE_NEW
+
+/* operator new must not return null: retry through the new_handler */
+static void *myAllocatorNew(std::size_t n, std::size_t align) {
+  for (;;) {
+    void *p = myAllocator::allocRegion(n, align);
+    if (p != nullptr)
+      return p;
+    std::new_handler handler = std::get_new_handler();
+    if (handler == nullptr)
+      throw std::bad_alloc();
+    handler();
+  }
+}
+
+static void *myAllocatorNewNothrow(std::size_t n, std::size_t align) noexcept {
+  try {
+    return myAllocatorNew(n, align);
+  } catch (...) {
+    return nullptr;
+  }
+}
+
+void *operator new(std::size_t n) { return myAllocatorNew(n, 0); }
+void *operator new[](std::size_t n) { return myAllocatorNew(n, 0); }
+void *operator new(std::size_t n, const std::nothrow_t &) noexcept { return myAllocatorNewNothrow(n, 0); }
+void *operator new[](std::size_t n, const std::nothrow_t &) noexcept { return myAllocatorNewNothrow(n, 0); }
+
+void *operator new(std::size_t n, std::align_val_t a) { return myAllocatorNew(n, std::size_t(a)); }
+void *operator new[](std::size_t n, std::align_val_t a) { return myAllocatorNew(n, std::size_t(a)); }
+void *operator new(std::size_t n, std::align_val_t a, const std::nothrow_t &) noexcept {
+  return myAllocatorNewNothrow(n, std::size_t(a));
+}
+void *operator new[](std::size_t n, std::align_val_t a, const std::nothrow_t &) noexcept {
+  return myAllocatorNewNothrow(n, std::size_t(a));
+}
+
+void operator delete(void *p) noexcept { freeRegion(p); }
+void operator delete[](void *p) noexcept { freeRegion(p); }
+void operator delete(void *p, const std::nothrow_t &) noexcept { freeRegion(p); }
+void operator delete[](void *p, const std::nothrow_t &) noexcept { freeRegion(p); }
+void operator delete(void *p, std::size_t n) noexcept { freeSizedRegion(p, n); }
+void operator delete[](void *p, std::size_t n) noexcept { freeSizedRegion(p, n); }
+
+void operator delete(void *p, std::align_val_t) noexcept { freeRegion(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { freeRegion(p); }
+void operator delete(void *p, std::align_val_t, const std::nothrow_t &) noexcept { freeRegion(p); }
+void operator delete[](void *p, std::align_val_t, const std::nothrow_t &) noexcept { freeRegion(p); }
+void operator delete(void *p, std::size_t n, std::align_val_t) noexcept { freeSizedRegion(p, n); }
+void operator delete[](void *p, std::size_t n, std::align_val_t) noexcept { freeSizedRegion(p, n); }
+
+#endif // MYALLOCATOR_REPLACE_NEW
+
+#endif // myAllocator_HPP
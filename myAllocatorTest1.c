@@ -1,8 +1,12 @@
 #include "stdio.h"
 #include "stdlib.h"
+#include "string.h"
 #include "myAllocator.h"
+#include "guardedAlloc.h"
 #include "sys/time.h"
 #include <sys/resource.h>
+#include <sys/wait.h>
+#include <signal.h>
 #include <unistd.h>
 
 double diffTimeval(struct timeval *t1, struct timeval *t2) {
@@ -34,6 +38,141 @@ int main()
   arenaCheck();
   freeRegion(p1);
   arenaCheck();
+  {				/* movable regions: free half, compact the rest */
+    Handle_t h[4000];
+    AllocatorStats_t before, after;
+    int i, bad = 0;
+    for (i = 0; i < 4000; i++) {
+      h[i] = hAlloc(1000);
+      snprintf(*h[i], 1000, "region %d", i);
+    }
+    for (i = 0; i < 4000; i += 2)
+      hFree(h[i]);
+    hLock(h[1]);		/* pinned: stays put */
+    getAllocatorStats(&before);
+    printf("compaction gave back %zdk\n", compactArena() / 1024);
+    getAllocatorStats(&after);
+    for (i = 1; i < 4000; i += 2) {
+      char expect[20];
+      snprintf(expect, sizeof expect, "region %d", i);
+      bad += strcmp(*h[i], expect) != 0;
+    }
+    printf("heap %zdk -> %zdk, %d regions corrupt\n", before.heapBytes / 1024, after.heapBytes / 1024, bad);
+    hUnlock(h[1]);
+    arenaCheck();
+    for (i = 1; i < 4000; i += 2)
+      hFree(h[i]);
+  }
+  arenaCheck();
+  {				/* defragment tiny runs by moving only hinted regions */
+    static void *r[20000];
+    AllocatorStats_t before, after;
+    int i, moved = 0;
+    for (i = 0; i < 20000; i++)
+      r[i] = firstFitAllocRegion(16);
+    for (i = 0; i < 20000; i++)
+      if (i % 1000 >= 100 + i / 1000 * 40) /* runs left fuller & fuller */
+        freeRegion(r[i]), r[i] = 0;
+    getAllocatorStats(&before);
+    for (i = 0; i < 20000; i++)
+      if (r[i] && regionDefragHint(r[i], 0)) {
+        void *n = firstFitAllocRegion(16);
+        memcpy(n, r[i], 16);
+        freeRegion(r[i]);
+        r[i] = n;
+        moved++;
+      }
+    getAllocatorStats(&after);
+    printf("defrag moved %d regions, heap %zdk -> %zdk\n", moved, before.heapBytes / 1024, after.heapBytes / 1024);
+    for (i = 0; i < 20000; i++)
+      freeRegion(r[i]);
+  }
+  arenaCheck();
+  {				/* reserve & prefault: then allocating doesn't fault */
+    static void *r[10000];
+    struct rusage u1, u2;
+    int i;
+    if (allocatorReserve(8 << 20, RESERVE_PREFAULT | RESERVE_CLASSES) != 0)
+      printf("can't reserve\n");
+    getrusage(RUSAGE_SELF, &u1);
+    for (i = 0; i < 10000; i++)
+      memset(r[i] = firstFitAllocRegion(500), i, 500);
+    getrusage(RUSAGE_SELF, &u2);
+    printf("%ld page faults allocating 5M after reserving 8M\n", u2.ru_minflt - u1.ru_minflt);
+    for (i = 0; i < 10000; i++)
+      freeRegion(r[i]);
+  }
+  arenaCheck();
+  {				/* many 40-byte requests: tuning gives them a class */
+    static void *r[1000];
+    AllocatorStats_t st;
+    size_t before, after;
+    int i, pass;
+    for (pass = 0; pass < 2; pass++) {
+      getAllocatorStats(&st);
+      before = st.metadataBytes;
+      for (i = 0; i < 1000; i++)
+	r[i] = firstFitAllocRegion(40);
+      getAllocatorStats(&st);
+      after = st.metadataBytes;
+      for (i = 0; i < 1000; i++)
+	freeRegion(r[i]);
+      printf("%s tuning, 1000 40-byte regions cost %zd bytes of headers\n",
+	     pass ? "after" : "before", after - before);
+      tuneSizeClasses();
+    }
+  }
+  arenaCheck();
+  {				/* guarded mode: the region is counted, overflowing it faults */
+    AllocatorStats_t st1, st2;
+    char *g;
+    int status;
+    pid_t pid;
+    getAllocatorStats(&st1);
+    guardedSampleRate = 1;	/* sample the next allocation */
+    g = firstFitAllocRegion(100);
+    guardedSampleRate = 0;
+    getAllocatorStats(&st2);
+    printf("guarded region %p: live bytes +%zd, heap +%zdk\n", g,
+	   st2.liveBytes - st1.liveBytes, (st2.heapBytes - st1.heapBytes) / 1024);
+    fflush(stdout);
+    if ((pid = fork()) == 0) {	/* overflow it by one byte */
+      memset(g, 1, regionUsableSpace(g) + 1);
+      _exit(0);
+    }
+    waitpid(pid, &status, 0);
+    printf("one-byte overflow %s\n", WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV
+	   ? "caught by the guard page" : "missed");
+    freeRegion(g);
+    getAllocatorStats(&st2);
+    printf("after freeing it, live bytes +%zd\n", st2.liveBytes - st1.liveBytes);
+  }
+  arenaCheck();
+  {				/* a grown block keeps its room through a remap */
+    void *r = firstFitAllocRegion(1000), *b = firstFitAllocRegion(100), *q;
+    r = resizeRegion(r, 3000);	/* had to move: grown */
+    r = resizeRegion(r, 2000000);	/* into a mapping of its own */
+    r = resizeRegion(r, 3000000);	/* mremap()ed */
+    q = resizeRegion(r, 900000);
+    printf("grown, remapped, then shrunk below 1M: %s\n", q == r ? "kept its mapping" : "copied back");
+    freeRegion(q);
+    freeRegion(b);
+  }
+  arenaCheck();
+  {				/* a grown block moving past 4K is counted as requested */
+    AllocatorStats_t st1, st2;
+    void *r, *b;
+    getAllocatorStats(&st1);
+    r = firstFitAllocRegion(1000);
+    b = firstFitAllocRegion(100);
+    r = resizeRegion(r, 3001);	/* had to move: grown */
+    r = resizeRegion(r, 3100);	/* moves again, into twice the room */
+    getAllocatorStats(&st2);
+    printf("after growing past 4K, live bytes +%zd (expect 3200)\n", st2.liveBytes - st1.liveBytes);
+    freeRegion(r);
+    freeRegion(b);
+  }
+  arenaCheck();
   {				/* measure time for 10000 mallocs */
     struct timeval t1, t2;
     int i;
@@ -0,0 +1,135 @@
+#ifndef objectPool_HPP
+#define objectPool_HPP
+
+/*
+  ObjectPool<T>: a fixed-size pool for one hot object type.
+
+  The pool takes chunks from the arena (one region per chunk) and
+  hands out sizeof(T)/alignof(T) slots from them, so allocating and
+  freeing an object never searches the arena, touches boundary tags or
+  coalesces.  A free slot holds the link of an
+  intrusive freelist; a fresh chunk is carved lazily with a bump
+  pointer so its pages are only touched as slots are used.
+
+  Slot size, chunk size and slots per chunk are all compile-time
+  constants.  ObjectPool<T>::local() returns a thread_local pool; its
+  objects must be destroyed by the thread that created them.  Chunks
+  are cache-line aligned & padded, so objects of different pools (and
+  so of different threads' local pools) never share a cache line.  Chunks go
+  back to the arena when the pool is destroyed, so no object may
+  outlive its pool.
+*/
+
+#include <cstddef>
+#include <new>
+#include <utility>
+
+#include "myAllocator.hpp"
+
+namespace myAllocator {
+
+template <class T, std::size_t ChunkBytes = 4096>
+class ObjectPool {
+  union Slot {
+    Slot *next;
+    alignas(T) unsigned char storage[sizeof(T)];
+  };
+
+  struct Chunk {
+    Chunk *next;
+  };
+
+  static constexpr std::size_t roundUp(std::size_t x, std::size_t a) {
+    return (x + a - 1) / a * a;
+  }
+
+public:
+  static constexpr std::size_t slotSize = sizeof(Slot);
+  static constexpr std::size_t slotAlign = alignof(Slot) > alignof(Chunk) ? alignof(Slot) : alignof(Chunk);
+  static constexpr std::size_t slotsOffset = roundUp(sizeof(Chunk), alignof(Slot));
+  static constexpr std::size_t minSlotsPerChunk = 8;
+  static constexpr std::size_t slotsPerChunk =
+      (ChunkBytes - slotsOffset) / slotSize > minSlotsPerChunk ? (ChunkBytes - slotsOffset) / slotSize
+                                                               : minSlotsPerChunk;
+  static constexpr std::size_t chunkSize = slotsOffset + slotsPerChunk * slotSize;
+
+  static_assert(slotSize % alignof(T) == 0, "slots must keep T aligned");
+  static_assert(ChunkBytes > slotsOffset, "chunk too small for its header");
+
+  ObjectPool() noexcept = default;
+  ObjectPool(const ObjectPool &) = delete;
+  ObjectPool &operator=(const ObjectPool &) = delete;
+
+  ~ObjectPool() {
+    while (chunks != nullptr) {
+      Chunk *c = chunks;
+      chunks = c->next;
+      freeSizedRegion(c, chunkSize);
+    }
+  }
+
+  /* raw slot, not yet constructed */
+  T *allocate() {
+    Slot *s = freeList;
+    if (s != nullptr)
+      freeList = s->next;
+    else if (bump != bumpEnd)
+      s = bump++;
+    else
+      s = refill();
+    return reinterpret_cast<T *>(s);
+  }
+
+  void deallocate(T *p) noexcept {
+    Slot *s = reinterpret_cast<Slot *>(p);
+    s->next = freeList;
+    freeList = s;
+  }
+
+  template <class... Args>
+  T *construct(Args &&...args) {
+    T *p = allocate();
+    try {
+      return ::new (static_cast<void *>(p)) T(std::forward<Args>(args)...);
+    } catch (...) {
+      deallocate(p);
+      throw;
+    }
+  }
+
+  void destroy(T *p) noexcept {
+    if (p != nullptr) {
+      p->~T();
+      deallocate(p);
+    }
+  }
+
+  /* this thread's pool for T */
+  static ObjectPool &local() {
+    thread_local ObjectPool pool;
+    return pool;
+  }
+
+private:
+  Slot *refill() {
+    void *mem = slotAlign > cacheLineSize ? allocRegion(chunkSize, slotAlign)
+                                          : cacheAlignedAllocRegion(chunkSize);
+    Chunk *c;
+    if (mem == nullptr)
+      throw std::bad_alloc();
+    c = static_cast<Chunk *>(mem);
+    c->next = chunks;
+    chunks = c;
+    bump = reinterpret_cast<Slot *>(static_cast<char *>(mem) + slotsOffset);
+    bumpEnd = bump + slotsPerChunk;
+    return bump++;
+  }
+
+  Slot *freeList = nullptr;
+  Slot *bump = nullptr, *bumpEnd = nullptr;
+  Chunk *chunks = nullptr;
+};
+
+} // namespace myAllocator
+
+#endif // objectPool_HPP
@@ -0,0 +1,117 @@
+#include <stdint.h>
+#include <sys/mman.h>
+#include "pageMap.h"
+
+/*
+  Page map.
+
+  free(), realloc() and malloc_usable_size() get nothing but a pointer,
+  yet the allocator has several kinds of memory: arena blocks with
+  prefixes, headerless tiny slots, guarded slots and large mapped
+  blocks.  The page map answers "which span owns this address" in O(1)
+  without reading anything near the pointer.
+
+  It is a two-level radix tree indexed by the 36-bit number of a 4K
+  page (48-bit user addresses): the root holds 2^18 leaf pointers and
+  each leaf holds 2^18 span pointers.  Leaves are mapped lazily with
+  MAP_NORESERVE, so only the parts actually written take memory.
+  Entries are published with release stores and read with acquire
+  loads, so lookups need no lock; a span must not be deleted while
+  another thread may still look up its pages, which holds because only
+  its owner frees it.
+
+  Spans for large mapped blocks are registered for the pages holding
+  their prefix and first region byte only: every caller passes the
+  region's start, and registering every page would make mremap() cost
+  time in proportion to the block size again.
+*/
+
+#define PAGE_SHIFT 12
+#define LEAF_BITS 18
+#define ROOT_BITS 18
+#define LEAF_SIZE ((size_t) 1 << LEAF_BITS)
+
+static Span_t **root[(size_t) 1 << ROOT_BITS];
+
+static Span_t **leafFor(uintptr_t pn, int create) {
+  Span_t **leaf = __atomic_load_n(&root[pn >> LEAF_BITS], __ATOMIC_ACQUIRE);
+  if (leaf == 0 && create) {
+    void *m = mmap(0, LEAF_SIZE * sizeof(Span_t *), PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (m == MAP_FAILED)
+      return 0;
+    leaf = m;
+    __atomic_store_n(&root[pn >> LEAF_BITS], leaf, __ATOMIC_RELEASE);
+  }
+  return leaf;
+}
+
+Span_t *pageMapLookup(void *addr) {
+  uintptr_t pn = (uintptr_t) addr >> PAGE_SHIFT;
+  Span_t **leaf;
+  if (pn >> (LEAF_BITS + ROOT_BITS))
+    return 0;
+  leaf = __atomic_load_n(&root[pn >> LEAF_BITS], __ATOMIC_ACQUIRE);
+  return leaf ? __atomic_load_n(&leaf[pn & (LEAF_SIZE - 1)], __ATOMIC_ACQUIRE) : 0;
+}
+
+/* point every page overlapping [begin, begin+length) at span (0 clears) */
+static int setRange(void *begin, size_t length, Span_t *span) {
+  uintptr_t pn = (uintptr_t) begin >> PAGE_SHIFT;
+  uintptr_t last = ((uintptr_t) begin + length - 1) >> PAGE_SHIFT;
+  if (length == 0)
+    return 1;
+  if (last >> (LEAF_BITS + ROOT_BITS))
+    return 0;
+  for (; pn <= last; pn++) {
+    Span_t **leaf = leafFor(pn, span != 0);
+    if (leaf == 0) {
+      if (span)
+        return 0;
+      pn |= LEAF_SIZE - 1;	/* nothing to clear in this leaf */
+      continue;
+    }
+    __atomic_store_n(&leaf[pn & (LEAF_SIZE - 1)], span, __ATOMIC_RELEASE);
+  }
+  return 1;
+}
+
+int pageMapSet(void *begin, size_t length, Span_t *span) { return setRange(begin, length, span); }
+
+void pageMapClear(void *begin, size_t length) { setRange(begin, length, 0); }
+
+/*
+  Span records come from their own mapped blocks of SPAN_BLOCK bytes,
+  recycled through a free list.
+*/
+#define SPAN_BLOCK 0x10000
+
+static Span_t *freeSpans = 0;
+static Span_t *spanBump = 0, *spanEnd = 0;
+
+Span_t *spanNew(int kind, void *begin, size_t length) {
+  Span_t *s;
+  if (freeSpans) {
+    s = freeSpans;
+    freeSpans = s->next;
+  } else {
+    if (spanBump == spanEnd) {
+      void *m = mmap(0, SPAN_BLOCK, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (m == MAP_FAILED)
+        return 0;
+      spanBump = m;
+      spanEnd = spanBump + SPAN_BLOCK / sizeof(Span_t);
+    }
+    s = spanBump++;
+  }
+  s->kind = kind;
+  s->begin = begin;
+  s->length = length;
+  s->next = 0;
+  return s;
+}
+
+void spanDelete(Span_t *s) {
+  s->next = freeSpans;
+  freeSpans = s;
+}
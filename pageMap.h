@@ -0,0 +1,34 @@
+#ifndef pageMap_H
+#define pageMap_H
+
+#include <stddef.h>
+
+/*
+  Radix page map from addresses to the span that owns them (see
+  pageMap.c).  pageMapLookup() takes no lock; everything else expects
+  the caller to hold the arena lock.
+*/
+
+enum {
+  SPAN_ARENA = 1,		/* boundary-tagged blocks */
+  SPAN_TINY,			/* tinyAlloc.c runs */
+  SPAN_GUARDED,			/* guardedAlloc.c pool */
+  SPAN_MAPPED,			/* one large block with its own mapping */
+  SPAN_BUDDY,			/* buddyAlloc.c region */
+};
+
+typedef struct Span_s {
+  int kind;
+  void *begin;			/* first byte covered */
+  size_t length;
+  struct Span_s *next;		/* free list, see spanNew() */
+} Span_t;
+
+Span_t *pageMapLookup(void *addr);
+int pageMapSet(void *begin, size_t length, Span_t *span);
+void pageMapClear(void *begin, size_t length);
+
+Span_t *spanNew(int kind, void *begin, size_t length);
+void spanDelete(Span_t *span);
+
+#endif // pageMap_H
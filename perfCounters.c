@@ -0,0 +1,106 @@
+#include <string.h>
+#include <unistd.h>
+#include "perfCounters.h"
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+/*
+  Event counters for the benchmarks.
+
+  Each counter is opened on its own (not as a group) for the calling
+  thread with inherit set, so threads it creates afterwards are
+  counted too; that is what the benchmark workers are.  The kernel may
+  multiplex counters that don't fit on the PMU at once, so each value
+  is scaled by time enabled / time running.
+*/
+
+const char *perfCounterNames[PERF_NCOUNTERS] = {
+  "cycles", "instructions", "L1d-misses", "LLC-misses", "dTLB-misses", "page-faults"
+};
+
+#ifdef __linux__
+#define CACHE_MISS(cache) \
+  ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const struct { unsigned type; unsigned long long config; } events[PERF_NCOUNTERS] = {
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+  { PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_L1D) },
+  { PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_LL) },
+  { PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_DTLB) },
+  { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+};
+
+int perfOpen(PerfCounters_t *pc) {
+  int i, n = 0;
+  for (i = 0; i < PERF_NCOUNTERS; i++) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof attr);
+    attr.size = sizeof attr;
+    attr.type = events[i].type;
+    attr.config = events[i].config;
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    pc->fd[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (pc->fd[i] < 0 && events[i].type == PERF_TYPE_SOFTWARE) {
+      attr.exclude_kernel = 0;	/* faults are taken in the kernel */
+      pc->fd[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+    n += pc->fd[i] >= 0;
+  }
+  return n;
+}
+
+void perfStart(PerfCounters_t *pc) {
+  int i;
+  for (i = 0; i < PERF_NCOUNTERS; i++)
+    if (pc->fd[i] >= 0) {
+      ioctl(pc->fd[i], PERF_EVENT_IOC_RESET, 0);
+      ioctl(pc->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+void perfStop(PerfCounters_t *pc, unsigned long long values[PERF_NCOUNTERS]) {
+  int i;
+  for (i = 0; i < PERF_NCOUNTERS; i++) {
+    unsigned long long v[3];	/* value, time enabled, time running */
+    values[i] = PERF_UNAVAILABLE;
+    if (pc->fd[i] < 0)
+      continue;
+    ioctl(pc->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+    if (read(pc->fd[i], v, sizeof v) == sizeof v && v[2] > 0)
+      values[i] = v[2] < v[1] ? (unsigned long long) ((double) v[0] * v[1] / v[2]) : v[0];
+  }
+}
+
+void perfClose(PerfCounters_t *pc) {
+  int i;
+  for (i = 0; i < PERF_NCOUNTERS; i++)
+    if (pc->fd[i] >= 0)
+      close(pc->fd[i]);
+}
+#else
+int perfOpen(PerfCounters_t *pc) {
+  int i;
+  for (i = 0; i < PERF_NCOUNTERS; i++)
+    pc->fd[i] = -1;
+  return 0;
+}
+
+void perfStart(PerfCounters_t *pc) { (void) pc; }
+
+void perfStop(PerfCounters_t *pc, unsigned long long values[PERF_NCOUNTERS]) {
+  int i;
+  (void) pc;
+  for (i = 0; i < PERF_NCOUNTERS; i++)
+    values[i] = PERF_UNAVAILABLE;
+}
+
+void perfClose(PerfCounters_t *pc) { (void) pc; }
+#endif
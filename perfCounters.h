@@ -0,0 +1,29 @@
+#ifndef perfCounters_H
+#define perfCounters_H
+
+/*
+  Hardware & software event counters around a piece of work, through
+  perf_event_open(2) (see perfCounters.c).  Counters the kernel won't
+  give us (no PMU, perf_event_paranoid, not Linux) read as
+  PERF_UNAVAILABLE.
+*/
+
+enum {
+  PERF_CYCLES, PERF_INSTRUCTIONS, PERF_L1D_MISSES, PERF_LLC_MISSES,
+  PERF_DTLB_MISSES, PERF_PAGE_FAULTS, PERF_NCOUNTERS
+};
+
+#define PERF_UNAVAILABLE (~0ULL)
+
+typedef struct PerfCounters_s {
+  int fd[PERF_NCOUNTERS];	/* -1: unavailable */
+} PerfCounters_t;
+
+extern const char *perfCounterNames[PERF_NCOUNTERS];
+
+int perfOpen(PerfCounters_t *pc);	/* number of counters available */
+void perfStart(PerfCounters_t *pc);
+void perfStop(PerfCounters_t *pc, unsigned long long values[PERF_NCOUNTERS]);
+void perfClose(PerfCounters_t *pc);
+
+#endif // perfCounters_H
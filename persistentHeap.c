@@ -0,0 +1,400 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "allocatorInternal.h"
+#include "persistentHeap.h"
+
+/*
+  Persistent heap.
+
+  The heap is a file mapped MAP_SHARED, laid out like an arena chunk: a
+  header page, a sentinel block, the blocks, and a closing sentinel.
+  Blocks use the arena's prefixes & suffixes, whose links are offsets,
+  so nothing in the file depends on where it is mapped.  Free blocks
+  are kept in a doubly-linked list threaded through their payloads,
+  again by offset from the start of the file; allocation is first fit
+  over that list and freeing coalesces with both neighbours.
+
+  pheapOpen() reserves maxSize bytes of address space and maps the file
+  at its start, so the heap can grow in place: the file is extended
+  (doubling, like the arena's chunks) and the new part mapped after
+  the old, and the closing sentinel moves to the new end.
+
+  The header's dirty flag is set before the first change after a
+  consistency point and cleared by pheapSync(), which msync()s the
+  whole heap first.  Opening a heap that is still dirty means its last
+  user stopped between consistency points, so pheapRecover() walks it
+  the way arenaCheck() walks the arena, checking every block's links
+  and rebuilding the free list.  That covers a crashed process, whose
+  writes are all in the page cache; surviving a crashed machine would
+  need the changes since the last pheapSync() to be journaled.
+
+  pheapOpenShared() puts the same heap in POSIX shared memory so that
+  processes can pass regions to each other by offset instead of
+  copying them.  Its lock is then a process-shared robust mutex, set
+  up once by whoever creates the heap; if a process dies holding it,
+  the next one to lock it runs the recovery walk first.  When one
+  process grows the heap, the others map the new part the next time
+  they lock it (or follow an offset into it).
+*/
+
+#define PHEAP_MAGIC "MAPHEAP1"
+#define PHEAP_HEADER_SIZE 4096
+#define PHEAP_INITIAL_SIZE 0x100000	/* 1M */
+
+typedef struct PheapHeader_s {	/* at offset 0 of the file */
+  char magic[8];
+  uint64_t size;		/* bytes of the file in use */
+  uint64_t root;		/* offset of the root region, 0: none */
+  uint64_t freeList;		/* offset of the first free block, 0: none */
+  uint64_t dirty;		/* changed since the last consistency point */
+  pthread_mutex_t lock;		/* files: reinitialized by each open */
+} PheapHeader_t;
+
+typedef struct PheapLinks_s {	/* payload of a free block */
+  uint64_t next, prev;		/* offsets of free blocks, 0: none */
+} PheapLinks_t;
+
+struct PersistentHeap_s {	/* per-process handle */
+  char *base;
+  size_t reserved;		/* address space for growth */
+  size_t mapped;		/* bytes of it mapped so far */
+  int fd;
+};
+
+#define header(h) ((PheapHeader_t *) (h)->base)
+#define minPayload sizeof(PheapLinks_t)
+#define sentinelSize (prefixSize + suffixSize)
+
+static size_t offsetOf(PersistentHeap_t *h, void *a) { return (char *) a - h->base; }
+static BlockPrefix_t *blockAt(PersistentHeap_t *h, uint64_t off) { return (BlockPrefix_t *) (h->base + off); }
+static PheapLinks_t *linksOf(BlockPrefix_t *p) { return prefixToRegion(p); }
+static BlockPrefix_t *firstBlock(PersistentHeap_t *h) { return blockAt(h, PHEAP_HEADER_SIZE + sentinelSize); }
+static BlockPrefix_t *lastSentinel(PersistentHeap_t *h) { return blockAt(h, header(h)->size - sentinelSize); }
+
+static int recoverLocked(PersistentHeap_t *h);
+
+/* map what another process added to the heap since we last looked */
+static void followGrowth(PersistentHeap_t *h) {
+  size_t size = header(h)->size;
+  if (size > h->mapped && size <= h->reserved
+      && mmap(h->base + h->mapped, size - h->mapped, PROT_READ | PROT_WRITE,
+              MAP_SHARED | MAP_FIXED, h->fd, h->mapped) != MAP_FAILED)
+    h->mapped = size;
+}
+
+static void lockHeap(PersistentHeap_t *h) {
+  if (pthread_mutex_lock(&header(h)->lock) == EOWNERDEAD) { /* holder died mid-change */
+    followGrowth(h);
+    if (recoverLocked(h) != 0) {
+      fprintf(stderr, "persistentHeap: damaged by a process that died\n");
+      abort();
+    }
+    pthread_mutex_consistent(&header(h)->lock);
+  }
+  followGrowth(h);
+}
+
+static void unlockHeap(PersistentHeap_t *h) { pthread_mutex_unlock(&header(h)->lock); }
+
+static void makeSentinel(void *addr) {
+  makeFreeBlock(addr, sentinelSize)->allocated = BLOCK_ALLOCATED | BLOCK_SENTINEL;
+}
+
+static void touch(PersistentHeap_t *h) {	/* about to change the heap */
+  if (!header(h)->dirty)
+    header(h)->dirty = 1;
+}
+
+static void pushFree(PersistentHeap_t *h, BlockPrefix_t *p) {
+  PheapLinks_t *l = linksOf(p);
+  uint64_t off = offsetOf(h, p);
+  p->allocated = 0;
+  l->prev = 0;
+  l->next = header(h)->freeList;
+  if (l->next)
+    linksOf(blockAt(h, l->next))->prev = off;
+  header(h)->freeList = off;
+}
+
+static void unlinkFree(PersistentHeap_t *h, BlockPrefix_t *p) {
+  PheapLinks_t *l = linksOf(p);
+  if (l->prev)
+    linksOf(blockAt(h, l->prev))->next = l->next;
+  else
+    header(h)->freeList = l->next;
+  if (l->next)
+    linksOf(blockAt(h, l->next))->prev = l->prev;
+}
+
+/* merge free block p with its free neighbours (all on the list) */
+static BlockPrefix_t *coalesceFree(PersistentHeap_t *h, BlockPrefix_t *p) {
+  BlockPrefix_t *next = computeNextPrefixAddr(p);
+  BlockPrefix_t *prev = blockPrefix(computePrevSuffixAddr(p));
+  if (!next->allocated) {
+    unlinkFree(h, next);
+    makeFreeBlock(p, (char *) computeNextPrefixAddr(next) - (char *) p);
+  }
+  if (!prev->allocated) {
+    unlinkFree(h, p);
+    makeFreeBlock(prev, (char *) computeNextPrefixAddr(p) - (char *) prev);
+    p = prev;
+  }
+  return p;
+}
+
+/* extend the file so a free block of s bytes fits at its end */
+static BlockPrefix_t *growHeap(PersistentHeap_t *h, size_t s) {
+  PheapHeader_t *hd = header(h);
+  size_t oldSize = hd->size, newSize = 2 * oldSize;
+  BlockPrefix_t *p;
+  if (newSize < oldSize + prefixSize + s + suffixSize)
+    newSize = alignUp(oldSize + prefixSize + s + suffixSize, (size_t) PHEAP_HEADER_SIZE);
+  if (newSize > h->reserved)
+    newSize = h->reserved;
+  if (newSize < oldSize + prefixSize + s + suffixSize
+      || ftruncate(h->fd, newSize) != 0
+      || mmap(h->base + oldSize, newSize - oldSize, PROT_READ | PROT_WRITE,
+              MAP_SHARED | MAP_FIXED, h->fd, oldSize) == MAP_FAILED)
+    return 0;
+  p = lastSentinel(h);		/* the old end becomes a free block */
+  h->mapped = newSize;
+  hd->size = newSize;
+  makeSentinel(lastSentinel(h));
+  makeFreeBlock(p, (char *) lastSentinel(h) - (char *) p);
+  pushFree(h, p);
+  return coalesceFree(h, p);
+}
+
+void *pheapAlloc(PersistentHeap_t *h, size_t s) {
+  size_t asize = align8(s < minPayload ? minPayload : s);
+  uint64_t off;
+  BlockPrefix_t *p = 0;
+  lockHeap(h);
+  touch(h);
+  for (off = header(h)->freeList; off; off = linksOf(p)->next) /* first fit */
+    if (computeUsableSpace(p = blockAt(h, off)) >= asize)
+      break;
+  if (off == 0 && (p = growHeap(h, asize)) == 0) {
+    unlockHeap(h);
+    return 0;
+  }
+  unlinkFree(h, p);
+  if (computeUsableSpace(p) >= asize + prefixSize + suffixSize + minPayload) { /* split */
+    void *rest = (char *) p + prefixSize + asize + suffixSize;
+    BlockPrefix_t *r = makeFreeBlock(rest, (char *) computeNextPrefixAddr(p) - (char *) rest);
+    makeFreeBlock(p, (char *) rest - (char *) p);
+    pushFree(h, r);
+  }
+  p->allocated = BLOCK_ALLOCATED;
+  unlockHeap(h);
+  return prefixToRegion(p);
+}
+
+void pheapFree(PersistentHeap_t *h, void *r) {
+  BlockPrefix_t *p;
+  if (r == 0)
+    return;
+  p = regionToPrefix(r);
+  lockHeap(h);
+  touch(h);
+  if (p->allocated != BLOCK_ALLOCATED) {
+    fprintf(stderr, "persistentHeap: double or invalid free of %p\n", r);
+    abort();
+  }
+  if (header(h)->root == offsetOf(h, r))
+    header(h)->root = 0;
+  pushFree(h, p);
+  coalesceFree(h, p);
+  unlockHeap(h);
+}
+
+void pheapSetRoot(PersistentHeap_t *h, void *r) {
+  lockHeap(h);
+  touch(h);
+  header(h)->root = r ? offsetOf(h, r) : 0;
+  unlockHeap(h);
+}
+
+void *pheapRoot(PersistentHeap_t *h) { return header(h)->root ? h->base + header(h)->root : 0; }
+
+size_t pheapOffset(PersistentHeap_t *h, void *r) { return r ? offsetOf(h, r) : 0; }
+
+void *pheapPointer(PersistentHeap_t *h, size_t offset) {
+  if (offset >= h->mapped) {	/* in a part another process added */
+    lockHeap(h);
+    unlockHeap(h);
+  }
+  return offset ? h->base + offset : 0;
+}
+
+int pheapSync(PersistentHeap_t *h) {
+  int ok;
+  lockHeap(h);
+  ok = msync(h->base, header(h)->size, MS_SYNC) == 0; /* everything, then... */
+  if (ok) {
+    header(h)->dirty = 0;	/* ...the consistency point itself */
+    ok = msync(h->base, PHEAP_HEADER_SIZE, MS_SYNC) == 0;
+  }
+  unlockHeap(h);
+  return ok ? 0 : -1;
+}
+
+/* the recovery walk: check every block, rebuild the free list */
+static int recoverLocked(PersistentHeap_t *h) {
+  PheapHeader_t *hd = header(h);
+  BlockPrefix_t *p = firstBlock(h), *last = lastSentinel(h);
+  int rootFound = hd->root == 0;
+  if (!(blockPrefix(computePrevSuffixAddr(p))->allocated & BLOCK_SENTINEL)
+      || last->allocated != (BLOCK_ALLOCATED | BLOCK_SENTINEL))
+    return -1;
+  hd->freeList = 0;
+  while (p != last) {
+    BlockSuffix_t *s;
+    if (p->suffix % 8 || p->suffix < prefixSize || (char *) p + p->suffix >= (char *) last
+        || (p->allocated != 0 && p->allocated != BLOCK_ALLOCATED))
+      return -1;		/* runs past the heap or isn't a block */
+    s = blockSuffix(p);
+    if (blockPrefix(s) != p)
+      return -1;		/* suffix doesn't reference prefix */
+    if (p->allocated == BLOCK_ALLOCATED) {
+      rootFound |= offsetOf(h, prefixToRegion(p)) == hd->root;
+    } else {			/* coalesce what an interrupted free left */
+      BlockPrefix_t *prev = blockPrefix(computePrevSuffixAddr(p));
+      if (!prev->allocated) {
+        makeFreeBlock(prev, (char *) computeNextPrefixAddr(p) - (char *) prev);
+        p = prev;
+      } else {
+        pushFree(h, p);
+      }
+    }
+    p = computeNextPrefixAddr(p);
+  }
+  if (!rootFound) {
+    fprintf(stderr, "persistentHeap: root doesn't name an allocated region, cleared\n");
+    hd->root = 0;
+  }
+  return 0;
+}
+
+int pheapRecover(PersistentHeap_t *h) {
+  int r;
+  lockHeap(h);
+  touch(h);
+  r = recoverLocked(h);
+  unlockHeap(h);
+  return r;
+}
+
+static void initLock(PheapHeader_t *hd) {
+  pthread_mutexattr_t a;
+  pthread_mutexattr_init(&a);
+  pthread_mutexattr_setpshared(&a, PTHREAD_PROCESS_SHARED);
+  pthread_mutexattr_setrobust(&a, PTHREAD_MUTEX_ROBUST);
+  pthread_mutex_init(&hd->lock, &a);
+  pthread_mutexattr_destroy(&a);
+}
+
+static void format(PersistentHeap_t *h, size_t size) {
+  PheapHeader_t *hd = header(h);
+  hd->size = size;
+  hd->root = hd->freeList = 0;
+  hd->dirty = 1;
+  initLock(hd);
+  makeSentinel(h->base + PHEAP_HEADER_SIZE);
+  makeSentinel(lastSentinel(h));
+  pushFree(h, makeFreeBlock(firstBlock(h), (char *) lastSentinel(h) - (char *) firstBlock(h)));
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memcpy(hd->magic, PHEAP_MAGIC, 8); /* last: marks the heap usable */
+}
+
+/* map h->fd, formatting it if created, else checking it; 0 if ok */
+static int mapHeap(PersistentHeap_t *h, const char *name, int created, int shared) {
+  struct stat st;
+  size_t size = PHEAP_INITIAL_SIZE;
+  int tries;
+  if (created) {
+    if (ftruncate(h->fd, size) != 0)
+      return -1;
+  } else {			/* a new shared heap may still be being set up */
+    for (tries = 0; fstat(h->fd, &st) == 0 && st.st_size == 0 && shared && tries < 1000; tries++)
+      nanosleep(&(struct timespec) { 0, 1000000 }, 0);
+    if (fstat(h->fd, &st) != 0 || st.st_size == 0)
+      return -1;
+    size = st.st_size;
+  }
+  if (size > h->reserved)
+    return -1;
+  h->base = mmap(0, h->reserved, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (h->base == MAP_FAILED
+      || mmap(h->base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, h->fd, 0) == MAP_FAILED)
+    return -1;
+  h->mapped = size;
+  if (created) {
+    format(h, size);
+    return 0;
+  }
+  for (tries = 0; memcmp(header(h)->magic, PHEAP_MAGIC, 8) != 0 && shared && tries < 1000; tries++)
+    nanosleep(&(struct timespec) { 0, 1000000 }, 0);
+  if (memcmp(header(h)->magic, PHEAP_MAGIC, 8) != 0 || header(h)->size < size) {
+    fprintf(stderr, "persistentHeap: %s is not a heap\n", name);
+    return -1;
+  }
+  if (!shared) {
+    initLock(header(h));	/* whoever held it is gone */
+    if (header(h)->dirty && pheapRecover(h) != 0) {
+      fprintf(stderr, "persistentHeap: %s is damaged\n", name);
+      return -1;
+    }
+  }
+  followGrowth(h);
+  return 0;
+}
+
+static PersistentHeap_t *openHeap(const char *name, size_t maxSize, int shared) {
+  PersistentHeap_t *h = firstFitAllocRegion(sizeof(PersistentHeap_t));
+  int created = 0;
+  if (h == 0)
+    return 0;
+  h->reserved = alignUp(maxSize, (size_t) PHEAP_HEADER_SIZE);
+  h->base = MAP_FAILED;
+  if (shared) {			/* exactly one opener creates it */
+    if ((h->fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600)) >= 0)
+      created = 1;
+    else if (errno == EEXIST)
+      h->fd = shm_open(name, O_RDWR, 0600);
+  } else if ((h->fd = open(name, O_RDWR | O_CREAT, 0644)) >= 0) {
+    struct stat st;
+    created = fstat(h->fd, &st) == 0 && st.st_size == 0;
+  }
+  if (h->fd >= 0 && mapHeap(h, name, created, shared) == 0)
+    return h;
+  if (h->base != MAP_FAILED)
+    munmap(h->base, h->reserved);
+  if (h->fd >= 0)
+    close(h->fd);
+  freeRegion(h);
+  return 0;
+}
+
+PersistentHeap_t *pheapOpen(const char *path, size_t maxSize) { return openHeap(path, maxSize, 0); }
+
+PersistentHeap_t *pheapOpenShared(const char *name, size_t maxSize) { return openHeap(name, maxSize, 1); }
+
+int pheapUnlinkShared(const char *name) { return shm_unlink(name); }
+
+void pheapClose(PersistentHeap_t *h) {
+  pheapSync(h);
+  munmap(h->base, h->reserved);
+  close(h->fd);
+  freeRegion(h);
+}
@@ -0,0 +1,42 @@
+#ifndef persistentHeap_H
+#define persistentHeap_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  A heap kept in a file (see persistentHeap.c).  Regions allocated here
+  survive the process: reopening the file maps them again, and
+  pheapRoot() finds the application's data.  Links between regions
+  should be stored as offsets (pheapOffset/pheapPointer), since the
+  heap may be mapped at a different address next time.
+
+  pheapOpenShared() opens (or creates) the same kind of heap in POSIX
+  shared memory named by name ("/something"), for several processes at
+  once: one allocates a region, hands its pheapOffset() to another, and
+  that one reads it through pheapPointer() without a copy.
+*/
+
+typedef struct PersistentHeap_s PersistentHeap_t;
+
+PersistentHeap_t *pheapOpen(const char *path, size_t maxSize);
+PersistentHeap_t *pheapOpenShared(const char *name, size_t maxSize);
+int pheapUnlinkShared(const char *name);
+void pheapClose(PersistentHeap_t *h);
+void *pheapAlloc(PersistentHeap_t *h, size_t s);
+void pheapFree(PersistentHeap_t *h, void *r);
+void pheapSetRoot(PersistentHeap_t *h, void *r);
+void *pheapRoot(PersistentHeap_t *h);
+size_t pheapOffset(PersistentHeap_t *h, void *r);
+void *pheapPointer(PersistentHeap_t *h, size_t offset);
+int pheapSync(PersistentHeap_t *h);	/* consistency point, 0 if ok */
+int pheapRecover(PersistentHeap_t *h);	/* check & rebuild, 0 if ok */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // persistentHeap_H
@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "persistentHeap.h"
+
+/* builds a list in a persistent heap, then reopens the heap to find it;
+   then passes messages between processes through a shared heap */
+
+typedef struct Node_s {
+  size_t next;			/* offset of the next node, 0: none */
+  int value;
+  char name[20];
+} Node_t;
+
+static int walk(PersistentHeap_t *h, int expectEvery) {
+  Node_t *n;
+  int count = 0, expect = 0;
+  for (n = pheapRoot(h); n; n = pheapPointer(h, n->next)) {
+    char name[20];
+    snprintf(name, sizeof name, "node %d", n->value);
+    if (n->value != expect || strcmp(name, n->name) != 0) {
+      printf("node %d corrupt (value %d, name '%s')\n", count, n->value, n->name);
+      exit(1);
+    }
+    expect += expectEvery;
+    count++;
+  }
+  return count;
+}
+
+int main(int argc, char **argv) {
+  const char *path = argc > 1 ? argv[1] : "pheapTest.heap";
+  PersistentHeap_t *h;
+  Node_t *n, *prev = 0;
+  int i;
+  unlink(path);
+
+  h = pheapOpen(path, 1 << 30);	/* build: 100000 nodes, grows the file */
+  for (i = 0; i < 100000; i++) {
+    n = pheapAlloc(h, sizeof(Node_t));
+    n->next = 0;
+    n->value = i;
+    snprintf(n->name, sizeof n->name, "node %d", i);
+    if (prev)
+      prev->next = pheapOffset(h, n);
+    else
+      pheapSetRoot(h, n);
+    prev = n;
+  }
+  pheapClose(h);
+
+  h = pheapOpen(path, 1 << 30);	/* warm restart: free the odd nodes */
+  printf("reopened: %d nodes\n", walk(h, 1));
+  for (n = pheapRoot(h); n && n->next; n = pheapPointer(h, n->next)) {
+    Node_t *odd = pheapPointer(h, n->next);
+    n->next = odd->next;
+    pheapFree(h, odd);
+  }
+  pheapSync(h);
+  pheapFree(h, pheapAlloc(h, 5000)); /* changed after the sync: dirty */
+
+  h = pheapOpen(path, 1 << 30);	/* as if the last process crashed */
+  printf("recovered: %d nodes\n", walk(h, 2));
+  pheapClose(h);
+  unlink(path);
+
+  {				/* child writes messages, parent reads them */
+    const char *name = "/pheapTest";
+    int fds[2], total = 0;
+    size_t off;
+    pheapUnlinkShared(name);
+    if (pipe(fds) != 0)
+      return 1;
+    if (fork() == 0) {
+      h = pheapOpenShared(name, 1 << 30);
+      for (i = 0; i < 1000; i++) { /* large enough to make the heap grow */
+        char *m = pheapAlloc(h, 10000);
+        snprintf(m, 10000, "message %d", i);
+        off = pheapOffset(h, m);
+        write(fds[1], &off, sizeof off);
+      }
+      _exit(0);
+    }
+    h = pheapOpenShared(name, 1 << 30);
+    close(fds[1]);
+    for (i = 0; read(fds[0], &off, sizeof off) == sizeof off; i++) {
+      char expect[20], *m = pheapPointer(h, off);
+      snprintf(expect, sizeof expect, "message %d", i);
+      if (strcmp(m, expect) != 0) {
+        printf("message %d corrupt: '%s'\n", i, m);
+        return 1;
+      }
+      pheapFree(h, m);
+      total++;
+    }
+    wait(0);
+    printf("shared: %d messages passed\n", total);
+    pheapClose(h);
+    pheapUnlinkShared(name);
+  }
+  return 0;
+}
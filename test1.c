@@ -1,9 +1,11 @@
 #include "stdio.h"
 #include "stdlib.h"
 #include "myAllocator.h"
+#include "mallocx.h"
 #include "sys/time.h"
 #include <sys/resource.h>
 #include <unistd.h>
+#include <errno.h>
 
 double diffTimeval(struct timeval *t1, struct timeval *t2) {
   double d = (t1->tv_sec - t2->tv_sec) + (1.0e-6 * (t1->tv_usec - t2->tv_usec));
@@ -36,6 +38,32 @@ int main()
   arenaCheck();
   free(p1);
   arenaCheck();
+  {				/* size queries agree with what is granted */
+    size_t sizes[] = { 5, 254, 5000, 25400, 300000, 2000000 };
+    int i;
+    for (i = 0; i < sizeof sizes / sizeof sizes[0]; i++) {
+      smallocx_return_t r = smallocx(sizes[i], 0);
+      printf("good size of %zd: %zd, granted %zd\n", sizes[i], malloc_good_size(sizes[i]), r.size);
+      if (r.size < nallocx(sizes[i], 0) || r.size != regionUsableSpace(r.ptr))
+        printf("  wrong\n");
+      free(r.ptr);
+    }
+  }
+  arenaCheck();
+  {				/* alignments must be powers of 2 */
+    size_t aligns[] = { 16, 64, 4096, 24, 0 };
+    int i;
+    for (i = 0; i < sizeof aligns / sizeof aligns[0]; i++) {
+      void *p;
+      errno = 0;
+      p = aligned_alloc(aligns[i], 100);
+      printf("aligned_alloc(%zd, 100): %s\n", aligns[i],
+             p ? ((size_t) p % aligns[i] ? "misaligned" : "aligned")
+             : errno == EINVAL ? "EINVAL" : "failed");
+      free(p);
+    }
+  }
+  arenaCheck();
   {				/* measure time for 10000 mallocs */
     struct timeval t1, t2;
     int i;
@@ -0,0 +1,367 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <assert.h>
+#include <sys/mman.h>
+#include "allocatorInternal.h"
+#include "pageMap.h"
+#include "tinyAlloc.h"
+
+/*
+  Tiny-object allocator.
+
+  Requests of TINY_MAX bytes or less don't get a block in the arena
+  (whose prefix & suffix would cost 24 bytes for a 4-byte payload).
+  Instead they get an 8- or 16-byte slot in a run: a page of equal-sized
+  slots inside one reserved region, so a slot carries no header at all.
+
+  Larger requests up to TINY_ADAPTIVE_MAX get a slot too if one of up
+  to TINY_ADAPTIVE adaptive classes fits them; those classes follow the
+  process's own sizes.  tinyAlloc() counts every request it sees in a
+  histogram of 8-byte buckets, and every TUNE_INTERVAL requests (or on
+  tuneSizeClasses()) tinyTune() picks the classes that minimize the
+  bytes lost per request: a slot's rounding for sizes it serves, or the
+  arena's prefix & suffix for sizes no class serves.  A class that is
+  dropped is retired: it hands out no more slots, and its runs are
+  released as they drain, after which its entry can be reused.
+
+  Each run's metadata lives out of line in runs[], found by address
+  arithmetic.  A run tracks its free slots in a bitmap (1 = free);
+  allocation scans from the run's hint word and takes the lowest set bit
+  with a count-trailing-zeros, and freeing sets the bit again.  Each
+  size class keeps a doubly-linked list of runs that have free slots.
+  A run that becomes empty is returned to the kernel (MADV_DONTNEED)
+  unless it is its class's only partial run.
+*/
+
+#define TINY_REGION_SIZE (16 << 20) /* reserved address space */
+#define TINY_RUN_SIZE 4096
+#define TINY_NRUNS (TINY_REGION_SIZE / TINY_RUN_SIZE)
+#define TINY_MIN_SLOT 8
+#define TINY_RUN_WORDS (TINY_RUN_SIZE / TINY_MIN_SLOT / 64)
+
+typedef struct TinyRun_s {
+  uint64_t freeMask[TINY_RUN_WORDS];
+  struct TinyRun_s *prev, *next; /* runs of this class with free slots */
+  unsigned short slotSize, nslots, nfree, hint;
+  unsigned char cls;		/* its entry in classes[] */
+  unsigned char slack[TINY_RUN_SIZE / TINY_MIN_SLOT]; /* per slot: slotSize - requested */
+} TinyRun_t;
+
+typedef struct TinyClass_s {
+  size_t slotSize;		/* 0: entry unused */
+  TinyRun_t *partial;
+  size_t slots, used;		/* in all its runs, for tinyOccupancy() */
+  int retired;			/* no new slots, see tinyTune() */
+} TinyClass_t;
+
+#define TINY_ADAPTIVE 4
+#define TINY_BUCKETS (TINY_ADAPTIVE_MAX / 8 + 1) /* bucket b: sizes 8b-7 .. 8b */
+#define FIXED_BUCKETS (TINY_MAX / 8 + 1) /* buckets the 8 & 16 classes serve */
+#define TUNE_INTERVAL 65536
+
+static TinyClass_t classes[2 + TINY_ADAPTIVE] = { { 8 }, { 16 } };
+static signed char classFor[TINY_BUCKETS] = { 0, 0, 1, [FIXED_BUCKETS ... TINY_BUCKETS - 1] = -1 }; /* -1: to the arena */
+static unsigned long histogram[TINY_BUCKETS];
+static unsigned long untilTune = TUNE_INTERVAL;
+
+static char *regionBegin = 0, *regionEnd = 0;
+static Span_t regionSpan = { SPAN_TINY };
+static TinyRun_t runs[TINY_NRUNS];
+static int runsCarved = 0;	/* runs[0..runsCarved) have been used */
+static TinyRun_t *freeRuns = 0;	/* released runs, linked through next */
+
+static char *runBase(TinyRun_t *run) { return regionBegin + (run - runs) * (size_t) TINY_RUN_SIZE; }
+
+static TinyClass_t *classOf(TinyRun_t *run) { return &classes[run->cls]; }
+
+static void pushPartial(TinyClass_t *c, TinyRun_t *run) {
+  run->prev = 0;
+  run->next = c->partial;
+  if (c->partial)
+    c->partial->prev = run;
+  c->partial = run;
+}
+
+static void unlinkPartial(TinyClass_t *c, TinyRun_t *run) {
+  if (run->prev)
+    run->prev->next = run->next;
+  else
+    c->partial = run->next;
+  if (run->next)
+    run->next->prev = run->prev;
+}
+
+static TinyRun_t *newRun(TinyClass_t *c) {
+  TinyRun_t *run;
+  int i;
+  if (regionBegin == 0) {	/* reserve the region on first use */
+    void *p = mmap(0, TINY_REGION_SIZE, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED)
+      return 0;
+    if (!pageMapSet(p, TINY_REGION_SIZE, &regionSpan)) {
+      munmap(p, TINY_REGION_SIZE);
+      return 0;
+    }
+    regionBegin = p;
+    regionEnd = regionBegin + TINY_REGION_SIZE;
+    regionSpan.begin = regionBegin;
+    regionSpan.length = TINY_REGION_SIZE;
+  }
+  if (freeRuns) {
+    run = freeRuns;
+    freeRuns = run->next;
+  } else if (runsCarved < TINY_NRUNS) {
+    run = &runs[runsCarved++];
+  } else {
+    return 0;			/* region full: caller falls back to the arena */
+  }
+  run->slotSize = c->slotSize;
+  run->cls = c - classes;
+  run->nslots = run->nfree = TINY_RUN_SIZE / c->slotSize;
+  run->hint = 0;
+  for (i = 0; i < TINY_RUN_WORDS; i++) {
+    int first = i * 64;
+    if (first + 64 <= run->nslots)
+      run->freeMask[i] = ~(uint64_t) 0;
+    else if (first < run->nslots)
+      run->freeMask[i] = ((uint64_t) 1 << (run->nslots - first)) - 1;
+    else
+      run->freeMask[i] = 0;
+  }
+  pushPartial(c, run);
+  c->slots += run->nslots;
+  noteHeapGrowth(TINY_RUN_SIZE);
+  return run;
+}
+
+static void releaseRun(TinyClass_t *c, TinyRun_t *run) {
+  unlinkPartial(c, run);
+  madvise(runBase(run), TINY_RUN_SIZE, MADV_DONTNEED);
+  c->slots -= run->nslots;
+  run->nslots = run->nfree = 0;
+  run->next = freeRuns;
+  freeRuns = run;
+  noteHeapShrink(TINY_RUN_SIZE);
+}
+
+/*
+  Choosing adaptive classes.  Each bucket b above the fixed classes is
+  a candidate slot size 8b.  A request in bucket x served by a class of
+  bucket i > x loses 8(i-x) bytes; one no class serves goes to the
+  arena and loses prefixSize+suffixSize.  cost[j][i] is the least loss
+  for buckets up to i with j classes, the largest being i; the best
+  choice is the cheapest cost[j][i] plus the arena's loss above i.
+*/
+
+static int chooseClasses(size_t chosen[TINY_ADAPTIVE]) { /* returns how many */
+  double cost[TINY_ADAPTIVE + 1][TINY_BUCKETS], above[TINY_BUCKETS + 1];
+  int from[TINY_ADAPTIVE + 1][TINY_BUCKETS];
+  int i, j, a, x, bestJ = 0, bestI = FIXED_BUCKETS - 1;
+  double best;
+  above[TINY_BUCKETS] = 0;	/* arena's loss for buckets >= i */
+  for (i = TINY_BUCKETS - 1; i >= 0; i--)
+    above[i] = above[i + 1] + (i >= FIXED_BUCKETS ? histogram[i] * (double) (prefixSize + suffixSize) : 0);
+  best = above[FIXED_BUCKETS];	/* no adaptive classes */
+  for (j = 1; j <= TINY_ADAPTIVE; j++)
+    for (i = FIXED_BUCKETS; i < TINY_BUCKETS; i++) {
+      cost[j][i] = -1;
+      for (a = (j == 1 ? FIXED_BUCKETS - 1 : FIXED_BUCKETS); a < i; a++) {
+        double c = 0;
+        if (j > 1 && (a < FIXED_BUCKETS || cost[j - 1][a] < 0))
+          continue;
+        c = j > 1 ? cost[j - 1][a] : 0;
+        for (x = a + 1; x <= i; x++)
+          c += histogram[x] * 8.0 * (i - x);
+        if (cost[j][i] < 0 || c < cost[j][i]) {
+          cost[j][i] = c;
+          from[j][i] = a;
+        }
+        if (j == 1)
+          break;		/* one class: nothing below it */
+      }
+      if (cost[j][i] >= 0 && cost[j][i] + above[i + 1] < best) {
+        best = cost[j][i] + above[i + 1];
+        bestJ = j;
+        bestI = i;
+      }
+    }
+  for (j = bestJ, i = bestI; j > 0; i = from[j][i], j--)
+    chosen[j - 1] = 8 * i;
+  return bestJ;
+}
+
+/* adopt the classes the histogram calls for, then let it decay */
+void tinyTune() {
+  size_t chosen[TINY_ADAPTIVE];
+  int n = chooseClasses(chosen), i, k, b;
+  for (k = 2; k < 2 + TINY_ADAPTIVE; k++) { /* retire what isn't chosen */
+    TinyClass_t *c = &classes[k];
+    int keep = 0;
+    for (i = 0; i < n; i++)
+      keep |= c->slotSize == chosen[i];
+    if (keep) {
+      c->retired = 0;		/* chosen again before it drained */
+    } else if (c->slotSize && !c->retired) {
+      TinyRun_t *run = c->partial, *next;
+      c->retired = 1;
+      for (; run; run = next) {	/* release the runs already empty */
+        next = run->next;
+        if (run->nfree == run->nslots)
+          releaseRun(c, run);
+      }
+    }
+    if (c->retired && c->slots == 0)
+      c->slotSize = 0, c->retired = 0; /* drained: free for reuse */
+  }
+  for (i = 0; i < n; i++) {	/* give new sizes a free entry, if there is one */
+    int found = 0, freeEntry = -1;
+    for (k = 2; k < 2 + TINY_ADAPTIVE; k++) {
+      found |= classes[k].slotSize == chosen[i];
+      if (classes[k].slotSize == 0 && freeEntry < 0)
+        freeEntry = k;
+    }
+    if (!found && freeEntry >= 0) {
+      classes[freeEntry].slotSize = chosen[i];
+      classes[freeEntry].partial = 0;
+    }
+  }
+  for (b = FIXED_BUCKETS; b < TINY_BUCKETS; b++) { /* route each bucket */
+    classFor[b] = -1;
+    for (k = 2; k < 2 + TINY_ADAPTIVE; k++)
+      if (classes[k].slotSize >= 8 * b && !classes[k].retired
+          && (classFor[b] < 0 || classes[k].slotSize < classes[classFor[b]].slotSize))
+        classFor[b] = k;
+  }
+  for (b = 0; b < TINY_BUCKETS; b++)
+    histogram[b] /= 2;
+  untilTune = TUNE_INTERVAL;
+}
+
+void *tinyAlloc(size_t s) {
+  size_t b = (s + 7) / 8;
+  TinyClass_t *c;
+  TinyRun_t *run;
+  int w, bit, i;
+  histogram[b] += 1;
+  if (--untilTune == 0)
+    tinyTune();
+  if (classFor[b] < 0)
+    return 0;
+  c = &classes[classFor[b]];
+  run = c->partial;
+  if (run == 0 && (run = newRun(c)) == 0)
+    return 0;
+  for (w = run->hint; run->freeMask[w] == 0; w++) /* nfree > 0, so this stops */
+    ;
+  bit = __builtin_ctzll(run->freeMask[w]);
+  run->freeMask[w] &= run->freeMask[w] - 1; /* clear lowest set bit */
+  run->hint = w;
+  if (--run->nfree == 0)
+    unlinkPartial(c, run);
+  c->used += 1;
+  i = w * 64 + bit;
+  run->slack[i] = run->slotSize - s;
+  noteRegionAllocated(s, run->slotSize, 0);
+  return runBase(run) + i * (size_t) run->slotSize;
+}
+
+int tinyOwns(void *r) { return (char *) r >= regionBegin && (char *) r < regionEnd; }
+
+static TinyRun_t *runOf(void *r) { return &runs[((char *) r - regionBegin) / TINY_RUN_SIZE]; }
+
+void tinyFree(void *r) {
+  TinyRun_t *run = runOf(r);
+  TinyClass_t *c = classOf(run);
+  size_t i = ((char *) r - runBase(run)) / run->slotSize;
+  uint64_t mask = (uint64_t) 1 << (i % 64);
+  if (run->nslots == 0 || i >= run->nslots || (char *) r != runBase(run) + i * run->slotSize
+      || (run->freeMask[i / 64] & mask)) {
+    fprintf(stderr, "tinyAlloc: double or invalid free of %p\n", r);
+    abort();
+  }
+  run->freeMask[i / 64] |= mask;
+  if (i / 64 < run->hint)
+    run->hint = i / 64;
+  noteRegionFreed(run->slotSize - run->slack[i], run->slotSize, 0);
+  c->used -= 1;
+  if (run->nfree++ == 0)	/* was full: has room again */
+    pushPartial(c, run);
+  else if (run->nfree == run->nslots && (run->prev || run->next || c->retired))
+    releaseRun(c, run);		/* empty and not the last partial run */
+}
+
+/* r may keep its slot for newSize if it fits */
+int tinyResize(void *r, size_t newSize) {
+  TinyRun_t *run = runOf(r);
+  size_t i = ((char *) r - runBase(run)) / run->slotSize;
+  if (newSize > run->slotSize)
+    return 0;
+  noteRegionFreed(run->slotSize - run->slack[i], run->slotSize, 0);
+  run->slack[i] = run->slotSize - newSize;
+  noteRegionAllocated(newSize, run->slotSize, 0);
+  return 1;
+}
+
+size_t tinyUsableSpace(void *r) { return runOf(r)->slotSize; }
+
+/* the slot tinyAlloc(s) would give, 0 if s goes to the arena */
+size_t tinySlotSize(size_t s) {
+  int k = classFor[(s + 7) / 8];
+  return k < 0 ? 0 : classes[k].slotSize;
+}
+
+/* r's run is emptier than its class's runs on average, and new slots
+   don't come from it: moving r helps the run empty and be released */
+int tinyOccupancy(void *r, RegionOccupancy_t *occ) {
+  TinyRun_t *run = runOf(r);
+  TinyClass_t *c = classOf(run);
+  occ->containerUsed = (size_t) (run->nslots - run->nfree) * run->slotSize;
+  occ->containerSize = (size_t) run->nslots * run->slotSize;
+  occ->kindUsed = c->used * c->slotSize;
+  occ->kindSize = c->slots * c->slotSize;
+  if (c->retired)		/* moving r helps the class drain */
+    return 1;
+  return run != c->partial && (size_t) (run->nslots - run->nfree) * c->slots < c->used * run->nslots;
+}
+
+/* give each class a run to take slots from, see allocatorReserve() */
+int tinyReserve(int flags) {
+  size_t i;
+  for (i = 0; i < sizeof classes / sizeof classes[0]; i++) {
+    TinyRun_t *run = classes[i].partial;
+    if (classes[i].slotSize == 0 || classes[i].retired)
+      continue;
+    if (run == 0 && (run = newRun(&classes[i])) == 0)
+      return -1;
+    if (reserveRange(runBase(run), TINY_RUN_SIZE, flags) != 0)
+      return -1;
+  }
+  return 0;
+}
+
+void tinyCheck() {		/* consistency check, popcount the bitmaps */
+  int i, w, active = 0;
+  size_t used = 0;
+  for (i = 0; i < runsCarved; i++) {
+    TinyRun_t *run = &runs[i];
+    int nfree = 0;
+    if (run->nslots == 0)	/* released */
+      continue;
+    for (w = 0; w < TINY_RUN_WORDS; w++)
+      nfree += __builtin_popcountll(run->freeMask[w]);
+    assert(nfree == run->nfree);
+    active += 1;
+    used += (size_t) (run->nslots - nfree) * run->slotSize;
+  }
+  if (active) {
+    fprintf(stderr, " tcheck: runs=%d, amtAllocated=%zdk, runSpace=%zdk, classes=",
+            active, used / 1024, (size_t) active * TINY_RUN_SIZE / 1024);
+    for (i = 0; i < 2 + TINY_ADAPTIVE; i++)
+      if (classes[i].slotSize)
+        fprintf(stderr, "%s%zd%s", i ? "," : "", classes[i].slotSize, classes[i].retired ? "(retired)" : "");
+    fprintf(stderr, "\n");
+  }
+}
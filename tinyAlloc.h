@@ -0,0 +1,26 @@
+#ifndef tinyAlloc_H
+#define tinyAlloc_H
+
+#include <stddef.h>
+#include "myAllocator.h"
+
+/*
+  Bitmap allocator for tiny objects (see tinyAlloc.c).  Callers hold
+  the arena lock; the page map tells which regions are tiny.
+*/
+
+#define TINY_MAX 16		/* largest request always served here */
+#define TINY_ADAPTIVE_MAX 256	/* largest one an adaptive class may serve */
+
+void *tinyAlloc(size_t s);		/* 0: no class for s, or no room */
+void tinyTune(void);
+int tinyOwns(void *r);			/* r is in the tiny region? */
+void tinyFree(void *r);
+int tinyResize(void *r, size_t newSize); /* true if r can stay */
+size_t tinyUsableSpace(void *r);
+size_t tinySlotSize(size_t s);
+int tinyOccupancy(void *r, RegionOccupancy_t *occ);
+int tinyReserve(int flags);
+void tinyCheck(void);
+
+#endif // tinyAlloc_H
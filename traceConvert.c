@@ -0,0 +1,216 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include "mallocTrace.h"
+
+/*
+  traceConvert: turn a recording made with MYALLOCATOR_TRACE into a
+  replayable trace in the CMU malloc-lab format:
+
+    <suggested heap size>
+    <number of ids>
+    <number of operations>
+    <weight>
+    a <id> <size>      allocate
+    r <id> <size>      reallocate
+    f <id>             free
+
+  The recording's events are sorted by time (each thread's flushes are
+  interleaved in the file) and its addresses are mapped to ids.  Frees
+  of addresses allocated before recording began are left out, and an
+  address that reappears without having been freed (its free was
+  dropped) has its old id freed first.  Aligned allocations become
+  plain ones, since the format has no alignment.
+
+  usage: traceConvert recording > trace.rep
+*/
+
+typedef struct Op_s {
+  char op;
+  unsigned id;
+  uint64_t size;
+} Op_t;
+
+typedef struct Rec_s {
+  TraceEvent_t e;
+  size_t seq;			/* position in the file, breaks ties */
+} Rec_t;
+
+static Rec_t *events;
+static size_t nevents;
+static Op_t *ops;
+static size_t nops, opsCapacity;
+
+/* open-addressed map from address to id + 1 (0: empty slot) */
+#define TOMBSTONE 1		/* never an address: they're 8-aligned */
+static uint64_t *keys;
+static unsigned *ids;
+static uint64_t *sizes;		/* live size per id */
+static size_t capacity, used, count, nids; /* used includes tombstones */
+static uint64_t live, peakLive;
+
+static void *xrealloc(void *p, size_t n) {
+  if ((p = realloc(p, n)) == 0) {
+    fprintf(stderr, "traceConvert: out of memory\n");
+    exit(1);
+  }
+  return p;
+}
+
+static size_t slotOf(uint64_t key) {
+  size_t i = (key >> 3) * 0x9E3779B97F4A7C15ull & (capacity - 1);
+  while (keys[i] != 0 && keys[i] != key)
+    i = (i + 1) & (capacity - 1);
+  return i;
+}
+
+static void put(uint64_t key, unsigned id);
+
+static void rehash() {		/* drop tombstones, grow if a quarter full of keys */
+  uint64_t *oldKeys = keys;
+  unsigned *oldIds = ids;
+  size_t oldCapacity = capacity, i;
+  if (capacity == 0)
+    capacity = 1024;
+  else if (4 * count > capacity)
+    capacity *= 2;
+  keys = xrealloc(0, capacity * sizeof(*keys));
+  ids = xrealloc(0, capacity * sizeof(*ids));
+  memset(keys, 0, capacity * sizeof(*keys));
+  memset(ids, 0, capacity * sizeof(*ids));
+  used = count = 0;
+  for (i = 0; i < oldCapacity; i++)
+    if (oldKeys[i] > TOMBSTONE)
+      put(oldKeys[i], oldIds[i] - 1); /* stored as id + 1 */
+  free(oldKeys);
+  free(oldIds);
+}
+
+static void put(uint64_t key, unsigned id) {
+  size_t i;
+  if (2 * (used + 1) > capacity)
+    rehash();
+  i = slotOf(key);
+  if (keys[i] == 0)
+    used += 1;
+  if (keys[i] != key)
+    count += 1;
+  keys[i] = key;
+  ids[i] = id + 1;
+}
+
+static unsigned take(uint64_t key) { /* remove key, return its id + 1 or 0 */
+  size_t i = slotOf(key);
+  unsigned id = ids[i];
+  if (keys[i] == 0)
+    return 0;
+  keys[i] = TOMBSTONE;
+  ids[i] = 0;
+  count -= 1;
+  return id;
+}
+
+static void emit(char op, unsigned id, uint64_t size) {
+  if (nops == opsCapacity) {
+    opsCapacity = opsCapacity ? 2 * opsCapacity : 4096;
+    ops = xrealloc(ops, opsCapacity * sizeof(*ops));
+  }
+  ops[nops].op = op;
+  ops[nops].id = id;
+  ops[nops].size = size;
+  nops += 1;
+  if (op == 'f') {
+    live -= sizes[id];
+  } else {
+    live += size - (op == 'r' ? sizes[id] : 0);
+    sizes[id] = size;
+  }
+  if (live > peakLive)
+    peakLive = live;
+}
+
+static void freeAddress(uint64_t ptr) {
+  unsigned id = take(ptr);
+  if (id)
+    emit('f', id - 1, 0);
+}
+
+static void allocate(uint64_t ptr, uint64_t size) {
+  freeAddress(ptr);		/* still live: its free was lost */
+  if (nids % 4096 == 0)
+    sizes = xrealloc(sizes, (nids + 4096) * sizeof(*sizes));
+  put(ptr, nids);
+  emit('a', nids++, size);
+}
+
+static int byTime(const void *a, const void *b) {
+  const Rec_t *x = a, *y = b;
+  if (x->e.time != y->e.time)
+    return x->e.time < y->e.time ? -1 : 1;
+  return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+int main(int argc, char **argv) {
+  FILE *f;
+  char magic[8];
+  size_t i, capacityEvents = 0;
+  TraceEvent_t e;
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s recording > trace.rep\n", argv[0]);
+    return 2;
+  }
+  if ((f = fopen(argv[1], "rb")) == 0 || fread(magic, 1, 8, f) != 8
+      || memcmp(magic, TRACE_MAGIC, 8) != 0) {
+    fprintf(stderr, "%s: %s is not a recording\n", argv[0], argv[1]);
+    return 1;
+  }
+  while (fread(&e, sizeof e, 1, f) == 1) {
+    if (nevents == capacityEvents) {
+      capacityEvents = capacityEvents ? 2 * capacityEvents : 4096;
+      events = xrealloc(events, capacityEvents * sizeof(*events));
+    }
+    events[nevents].e = e;
+    events[nevents].seq = nevents;
+    nevents += 1;
+  }
+  fclose(f);
+  qsort(events, nevents, sizeof(*events), byTime);
+
+  rehash();
+  for (i = 0; i < nevents; i++) {
+    TraceEvent_t *ev = &events[i].e;
+    switch (ev->op) {
+    case TRACE_MALLOC:
+    case TRACE_MEMALIGN:
+      if (ev->ptr)
+        allocate(ev->ptr, ev->size);
+      break;
+    case TRACE_FREE:
+      freeAddress(ev->ptr);
+      break;
+    case TRACE_REALLOC: {
+      unsigned id;
+      if (ev->ptr == 0)		/* failed, or realloc(p, 0) freed p */
+        break;
+      if (ev->old == 0 || (id = take(ev->old)) == 0) {
+        allocate(ev->ptr, ev->size);
+        break;
+      }
+      freeAddress(ev->ptr);	/* moved onto a stale address */
+      put(ev->ptr, id - 1);
+      emit('r', id - 1, ev->size);
+      break;
+    }
+    }
+  }
+
+  printf("%llu\n%zu\n%zu\n1\n", (unsigned long long) peakLive, nids, nops);
+  for (i = 0; i < nops; i++) {
+    if (ops[i].op == 'f')
+      printf("f %u\n", ops[i].id);
+    else
+      printf("%c %u %llu\n", ops[i].op, ops[i].id, (unsigned long long) ops[i].size);
+  }
+  return 0;
+}
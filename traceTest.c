@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/wait.h>
+
+/* records a malloc/realloc/free workload with MYALLOCATOR_TRACE, in a
+   child process so the recording is complete when it exits, then
+   converts it with traceConvert and checks that every id is allocated
+   once, freed once, and never used while it isn't live */
+
+#define THREADS 2
+#define LIVE 8000		/* per thread: enough for several rehashes */
+#define ROUNDS 2
+#define MARKER 54321		/* size of an allocation that starts the workload */
+
+static pthread_barrier_t start;
+
+static void *workload(void *arg) {
+  static void *r[THREADS][LIVE];
+  void **mine = r[(long) arg];
+  int round, i;
+  pthread_barrier_wait(&start);
+  for (round = 0; round < ROUNDS; round++) {
+    for (i = 0; i < LIVE; i++)
+      mine[i] = malloc(8 + (i * 37) % 600);
+    for (i = 0; i < LIVE; i += 4)	/* some grow and move, some shrink */
+      mine[i] = realloc(mine[i], i % 8 ? 2000 : 4);
+    for (i = 0; i < LIVE; i++)
+      free(mine[i]);
+  }
+  return arg;
+}
+
+static int record(const char *path) {
+  pthread_t t[THREADS];
+  long i;
+  pthread_barrier_init(&start, 0, THREADS);
+  for (i = 1; i < THREADS; i++)	/* libc's own allocations for the threads come first */
+    pthread_create(&t[i], 0, workload, (void *) i);
+  free(malloc(MARKER));
+  workload(0);
+  for (i = 1; i < THREADS; i++)
+    pthread_join(t[i], 0);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  const char *path = argc > 1 ? argv[1] : "traceTest.bin";
+  char env[256], cmd[512], op;
+  char *envp[] = { env, 0 };
+  unsigned long long heap, nids, nops, weight, id, size, total = 0, first = 0;
+  unsigned char *state;		/* per id: 0 unused, 1 live, 2 freed */
+  int status, bad = 0, ok;
+  pid_t pid;
+  FILE *f;
+  if (getenv("MYALLOCATOR_TRACE"))	/* we are the recording child */
+    return record(path);
+
+  snprintf(env, sizeof env, "MYALLOCATOR_TRACE=%s", path);
+  if ((pid = fork()) == 0) {
+    execve(argv[0], argv, envp);
+    _exit(127);
+  }
+  waitpid(pid, &status, 0);
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    printf("recording failed\n");
+    return 1;
+  }
+
+  snprintf(cmd, sizeof cmd, "%.*straceConvert %s",
+           (int) (strrchr(argv[0], '/') ? strrchr(argv[0], '/') + 1 - argv[0] : 0), argv[0], path);
+  if ((f = popen(cmd, "r")) == 0
+      || fscanf(f, "%llu %llu %llu %llu", &heap, &nids, &nops, &weight) != 4) {
+    printf("can't run %s\n", cmd);
+    return 1;
+  }
+  state = calloc(nids, 1);
+  while (fscanf(f, " %c %llu", &op, &id) == 2) {
+    if (op != 'f' && fscanf(f, "%llu", &size) == 1)
+      total += size;
+    if (op == 'a' && size == MARKER)
+      first = id + 1;		/* the workload's ids follow */
+    if (id >= nids
+        || (op == 'a' && state[id] != 0)
+        || (op == 'r' && state[id] != 1)
+        || (op == 'f' && state[id] != 1)) {
+      if (bad++ < 5)
+        printf("  %c %llu: id is %s\n", op, id,
+               id >= nids ? "out of range" : state[id] == 0 ? "not allocated" : state[id] == 1 ? "live" : "freed");
+      continue;
+    }
+    state[id] = op == 'f' ? 2 : 1;
+  }
+  pclose(f);
+  for (id = first; id < nids; id++)
+    if (state[id] != 2 && bad++ < 5)
+      printf("  id %llu never freed\n", id);
+  ok = !bad && heap <= total && first != 0 && nids - first == (unsigned long long) THREADS * ROUNDS * LIVE;
+  printf("%llu ids, %llu operations, heap size %llu (%s)\n", nids, nops, heap,
+         heap <= total ? "plausible" : "too large");
+  printf("%s\n", ok ? "round trip ok: every id allocated once and freed once" : "round trip FAILED");
+  unlink(path);
+  return !ok;
+}